@@ -329,8 +329,7 @@ static void do_index(duc *duc, duc_graph *graph, duc_dir *dir)
 		}
 	}
 
-	struct duc_index_report *report;
-	int i = 0;
+	const struct duc_report_info *info;
 
 	print_html_header(path);
 
@@ -346,11 +345,12 @@ static void do_index(duc *duc, duc_graph *graph, duc_dir *dir)
 	printf("   <th>Time</th>\n");
 	printf("  </tr>\n");
 
-	while( (report = duc_get_report(duc, i)) != NULL) {
+	duc_catalog *cat = duc_catalog_open(duc);
+	while( (info = duc_catalog_read(cat)) != NULL) {
 
 		char ts_date[32];
 		char ts_time[32];
-		time_t t = report->time_start.tv_sec;
+		time_t t = info->time_start.tv_sec;
 		struct tm *tm = localtime(&t);
 		strftime(ts_date, sizeof ts_date, "%Y-%m-%d",tm);
 		strftime(ts_time, sizeof ts_time, "%H:%M:%S",tm);
@@ -358,24 +358,22 @@ static void do_index(duc *duc, duc_graph *graph, duc_dir *dir)
 		duc_size_type st = opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
 
 		char siz[32];
-		duc_human_size(&report->size, st, 0, siz, sizeof siz);
+		duc_human_size(&info->size, st, 0, siz, sizeof siz);
 
 		printf("  <tr>\n");
 		printf("   <td><a href=\"%s&path=", url);
-		print_cgi(report->path);
+		print_cgi(info->path);
 		printf("\">");
-		print_html(report->path);
+		print_html(info->path);
 		printf("</a></td>\n");
 		printf("   <td>%s</td>\n", siz);
-		printf("   <td>%zu</td>\n", report->file_count);
-		printf("   <td>%zu</td>\n", report->dir_count);
+		printf("   <td>%zu</td>\n", info->file_count);
+		printf("   <td>%zu</td>\n", info->dir_count);
 		printf("   <td>%s</td>\n", ts_date);
 		printf("   <td>%s</td>\n", ts_time);
 		printf("  </tr>\n");
-
-		duc_index_report_free(report);
-		i++;
 	}
+	duc_catalog_close(cat);
 	printf(" </table>\n");
 
 	if(path) {
@@ -396,11 +394,11 @@ static void do_index(duc *duc, duc_graph *graph, duc_dir *dir)
 		printf("   <th class=size>Size</th>\n");
 		printf("  </tr>\n");
 
-		duc_dir_rewind(dir);
+		size_t i, count;
+		struct duc_dirent **list = duc_dir_read_topk(dir, st, 40, &count);
 
-		struct duc_dirent *e;
-		int n = 0;
-		while((n++ < 40) && (e = duc_dir_read(dir, st, DUC_SORT_SIZE)) != NULL) {
+		for(i=0; i<count; i++) {
+			struct duc_dirent *e = list[i];
 			char siz[32];
 			duc_human_size(&e->size, st, opt_bytes, siz, sizeof siz);
 			printf("  <tr><td class=name>");
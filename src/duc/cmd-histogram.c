@@ -22,9 +22,9 @@ static char *opt_database = NULL;
 
 static int histogram_db(duc *duc, char *file)
 {
-	struct duc_index_report *report;
+	duc_report *report;
 	duc_size_type st = opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
-	int i = 0;
+	duc_catalog *cat;
 
 	int r = duc_open(duc, file, DUC_OPEN_RO);
 	if(r != DUC_OK) {
@@ -32,25 +32,29 @@ static int histogram_db(duc *duc, char *file)
 		return -1;
 	}
 
-	while(( report = duc_get_report(duc, i)) != NULL) {
+	cat = duc_catalog_open(duc);
+	while(duc_catalog_read(cat) != NULL) {
 
-	    printf("Path: %s\n%3s %10s %10s\n",report->path,"Bkt","Size","Count");
+	    if((report = duc_catalog_get_report(cat)) == NULL) continue;
 
-	    size_t count;
+	    printf("Path: %s\n%3s %10s %10s\n",duc_report_get_info(report)->path,"Bkt","Size","Count");
+
+	    size_t count, buckets;
 	    size_t bucket_size = 0;
 	    char pretty[32];
+	    const size_t *histogram = duc_report_get_histogram(report, &buckets);
 	    setlocale(LC_NUMERIC, "");
-	    for (int i=0; i < report->histogram_buckets; i++) {
-		count = report->histogram[i];
+	    for (int i=0; i < buckets; i++) {
+		count = histogram[i];
 		bucket_size = pow(2, i);
 		int ret = humanize(bucket_size, 0, 1024, pretty, sizeof pretty);
 		printf("%3d %10s %'10d\n",i, pretty, count);
 	    }
 			
-	    duc_index_report_free(report);
+	    duc_report_close(report);
 	    printf("\n");
-	    i++;
 	}
+	duc_catalog_close(cat);
 
 	duc_close(duc);
 	
@@ -58,9 +62,62 @@ static int histogram_db(duc *duc, char *file)
 }
 
 
+/*
+ * Show the histogram stored for a single directory, which covers all
+ * files in the subtree below it
+ */
+
+static int histogram_path(duc *duc, char *file, const char *path)
+{
+	size_t histogram[DUC_DIR_HISTOGRAM_BUCKETS];
+	char pretty[32];
+	int i;
+
+	int r = duc_open(duc, file, DUC_OPEN_RO);
+	if(r != DUC_OK) {
+		duc_log(duc, DUC_LOG_FTL, "%s", duc_strerror(duc));
+		return -1;
+	}
+
+	duc_dir *dir = duc_dir_open(duc, path);
+	if(dir == NULL) {
+		duc_log(duc, DUC_LOG_FTL, "The requested path '%s' was not found in the database,", path);
+		duc_log(duc, DUC_LOG_FTL, "Please run 'duc info' for a list of available directories.");
+		duc_close(duc);
+		return -1;
+	}
+
+	int n = duc_dir_get_histogram(dir, histogram, DUC_DIR_HISTOGRAM_BUCKETS);
+	if(n < 0) {
+		duc_log(duc, DUC_LOG_FTL, "No histogram stored for '%s', please index with --dir-histogram", path);
+		duc_dir_close(dir);
+		duc_close(duc);
+		return -1;
+	}
+
+	char *path_dir = duc_dir_get_path(dir);
+	printf("Path: %s\n%3s %10s %10s\n", path_dir, "Bkt", "Size", "Count");
+	free(path_dir);
+
+	setlocale(LC_NUMERIC, "");
+	for(i=0; i<n && i<DUC_DIR_HISTOGRAM_BUCKETS; i++) {
+		humanize((size_t)1 << i, opt_bytes, 1024, pretty, sizeof pretty);
+		printf("%3d %10s %'10zu\n", i, pretty, histogram[i]);
+	}
+
+	duc_dir_close(dir);
+	duc_close(duc);
+
+	return 0;
+}
+
+
 static int histogram_main(duc *duc, int argc, char **argv)
 {
-    return(histogram_db(duc, opt_database));
+	if(argc > 0) {
+		return histogram_path(duc, opt_database, argv[0]);
+	}
+	return(histogram_db(duc, opt_database));
 }
 
 
@@ -76,7 +133,7 @@ static struct ducrc_option options[] = {
 struct cmd cmd_histogram = {
 	.name = "histogram",
 	.descr_short = "Dump histogram of file sizes found.",
-	.usage = "[options]",
+	.usage = "[options] [PATH]",
 	.main = histogram_main,
 	.options = options,
 };
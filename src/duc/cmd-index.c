@@ -28,6 +28,7 @@ static char *opt_username = NULL;
 static int opt_uid = 0;
 static int opt_histogram_buckets = DUC_HISTOGRAM_BUCKETS_DEF;
 static int opt_max_depth = 0;
+static int opt_path_index_depth = DUC_PATH_INDEX_DEPTH_DEF;
 static int opt_topn_min_size = DUC_TOPN_MIN_FILE_SIZE;
 static int opt_topn_cnt = DUC_TOPN_CNT;
 static int opt_topn_cnt_max = DUC_TOPN_CNT_MAX;
@@ -35,6 +36,11 @@ static bool opt_one_file_system = false;
 static bool opt_progress = false;
 static bool opt_uncompressed = false;
 static bool opt_dryrun = false;
+static int opt_threads = 1;
+static bool opt_io_uring = false;
+static bool opt_incremental = false;
+static bool opt_dir_histogram = false;
+static bool opt_write_behind = false;
 static duc_index_req *req;
 
 
@@ -78,13 +84,19 @@ static int index_main(duc *duc, int argc, char **argv)
 	
 	if(opt_force) open_flags |= DUC_OPEN_FORCE;
 	if(opt_max_depth) duc_index_req_set_maxdepth(req, opt_max_depth);
+	duc_index_req_set_path_depth(req, opt_path_index_depth);
 	if(opt_one_file_system) index_flags |= DUC_INDEX_XDEV;
 	if(opt_hide_file_names) index_flags |= DUC_INDEX_HIDE_FILE_NAMES;
 	if(opt_check_hard_links) index_flags |= DUC_INDEX_CHECK_HARD_LINKS;
 	if(opt_uncompressed) open_flags &= ~DUC_OPEN_COMPRESS;
 	if(opt_dryrun) index_flags |= DUC_INDEX_DRY_RUN;
+	if(opt_io_uring) index_flags |= DUC_INDEX_IO_URING;
+	if(opt_incremental) index_flags |= DUC_INDEX_INCREMENTAL;
+	if(opt_dir_histogram) index_flags |= DUC_INDEX_DIR_HISTOGRAM;
+	if(opt_write_behind) index_flags |= DUC_INDEX_WRITE_BEHIND;
 	if(opt_username) duc_index_req_set_username(req, opt_username);
 	if(opt_uid) duc_index_req_set_uid(req, opt_uid);
+	if(opt_threads > 1) duc_index_req_set_threads(req, opt_threads);
 	if(opt_topn_cnt) {
 	    if (opt_topn_cnt > DUC_TOPN_CNT_MAX) {
 		duc_log(duc, DUC_LOG_FTL, "Cannot store more than %d topN files", DUC_TOPN_CNT_MAX);
@@ -170,6 +182,18 @@ static int index_main(duc *duc, int argc, char **argv)
 					siz_apparent,
 					siz_actual,
 					dur);
+			if(report->hard_link_mem_peak) {
+				struct duc_size mem = { .apparent = report->hard_link_mem_peak };
+				char siz_mem[32];
+				duc_human_size(&mem, DUC_SIZE_TYPE_APPARENT, opt_bytes, siz_mem, sizeof siz_mem);
+				duc_log(duc, DUC_LOG_INF, "Hard link table used %sB of memory at its peak", siz_mem);
+			}
+			if(report->write_queue_peak) {
+				duc_log(duc, DUC_LOG_INF, "Write queue held up to %zu records, scanners waited %ld.%03ld s for the database",
+						report->write_queue_peak,
+						(long)report->write_stall.tv_sec,
+						(long)report->write_stall.tv_usec / 1000);
+			}
 		} else {
 			duc_log(duc, DUC_LOG_WRN, "An error occurred while indexing: %s", duc_strerror(duc));
 		}
@@ -212,9 +236,15 @@ static struct ducrc_option options[] = {
     { &opt_bytes,           "bytes",           'b', DUCRC_TYPE_BOOL,   "show file size in exact number of bytes" },
     { &opt_histogram_buckets, "buckets", 'B', DUCRC_TYPE_INT,    "number of buckets in histogram, default XX" },
     { &opt_database,        "database",        'd', DUCRC_TYPE_STRING, "use database file VAL" },  
-	{ fn_exclude,           "exclude",         'e', DUCRC_TYPE_FUNC,   "exclude files matching VAL"  },
+	{ &opt_dir_histogram,   "dir-histogram",    0 , DUCRC_TYPE_BOOL,   "store a file size histogram for every directory",
+	  "the histogram of a directory covers all files below it, and can be shown with 'duc histogram PATH'" },
+	{ fn_exclude,           "exclude",         'e', DUCRC_TYPE_FUNC,   "exclude files matching VAL",
+	  "VAL is a shell wildcard pattern matched against the file name. Patterns containing a '/' are matched "
+	  "against the path relative to the indexed directory instead, for example /build or src/*.o" },
 	{ &opt_check_hard_links,"check-hard-links",'H', DUCRC_TYPE_BOOL,   "count hard links only once",
-          "if two or more hard links point to the same file, only one of the hard links is displayed and counted" },
+          "if two or more hard links point to the same file, only one of the hard links is displayed and counted. "
+	  "With --threads, which of the links is counted can differ between runs, and so can the sizes of the "
+	  "directories holding them" },
 	{ &opt_force,           "force",           'f', DUCRC_TYPE_BOOL,   "force writing in case of corrupted db" },
 	{ fn_fs_exclude,        "fs-exclude",       0,  DUCRC_TYPE_FUNC,   "exclude file system type VAL during indexing",
 	  "VAL is a comma separated list of file system types as found in your systems fstab, for example ext3,ext4,dosfs" },
@@ -229,8 +259,29 @@ static struct ducrc_option options[] = {
 	{ &opt_max_depth,       "max-depth",       'm', DUCRC_TYPE_INT,    "limit directory names to given depth" ,
 	  "when this option is given duc will traverse the complete file system, but will only store the "
 	  "first VAL levels of directories in the database to reduce the size of the index" },
+	{ &opt_incremental,     "incremental",      0 , DUCRC_TYPE_BOOL,   "only read directories which changed since the last index",
+	  "directories with the same mtime as in the existing index are not read again, their file entries are "
+	  "taken from the database. Subdirectories are still visited. Files which are modified in place do not "
+	  "change the mtime of their directory, so their size is only updated by a full index. When the exclude, "
+	  "file system type, user, --max-depth, --check-hard-links or --one-file-system options differ from the "
+	  "previous run, all directories are read again" },
+	{ &opt_io_uring,        "io-uring",         0 , DUCRC_TYPE_BOOL,   "stat files in batches using io_uring",
+	  "all entries of a directory are submitted to the kernel at once instead of one stat() at a time. "
+	  "This helps on storage with high latency; on local disks with a warm cache the default is usually faster. "
+	  "Falls back to regular stat() when io_uring is not available" },
 	{ &opt_one_file_system, "one-file-system", 'x', DUCRC_TYPE_BOOL,   "skip directories on different file systems" },
+	{ &opt_path_index_depth,"path-index-depth", 0 , DUCRC_TYPE_INT,    "store the paths of directories up to VAL levels deep",
+	  "directories up to VAL levels below the indexed path are stored by path, so opening them does not need to "
+	  "read all directories above them. Deeper directories are found from their nearest stored parent. Defaults to 3" },
 	{ &opt_progress,        "progress",        'p', DUCRC_TYPE_BOOL,   "show progress during indexing" },
+	{ &opt_threads,         "threads",         't', DUCRC_TYPE_INT,    "number of threads scanning directories in parallel",
+	  "the directory tree is divided over VAL worker threads, which helps on file systems where the "
+	  "index time is dominated by stat() latency, like NFS or arrays with many spindles. The results do not "
+	  "depend on the number of threads, except for the hard links counted with --check-hard-links and the "
+	  "choice between equally sized files at the end of the topN list. Defaults to 1" },
+	{ &opt_write_behind,    "write-behind",     0 , DUCRC_TYPE_BOOL,   "write the database from a separate thread",
+	  "directories are scanned while the main thread writes finished records to the database, so the scan "
+	  "does not stall while the database flushes or compacts. This is always done when using --threads" },
 	{ &opt_dryrun,          "dry-run",          0 , DUCRC_TYPE_BOOL,   "do not update database, just crawl" },
 	{ &opt_uncompressed,    "uncompressed",     0 , DUCRC_TYPE_BOOL,   "do not use compression for database",
           "Duc enables compression if the underlying database supports this. This reduces index size at the cost "
@@ -21,9 +21,8 @@ static bool opt_histogram = false;
 
 static int info_db(duc *duc, char *file)
 {
-	struct duc_index_report *report;
+	const struct duc_report_info *info;
 	duc_size_type st = opt_apparent ? DUC_SIZE_TYPE_APPARENT : DUC_SIZE_TYPE_ACTUAL;
-	int i = 0;
 
 	int r = duc_open(duc, file, DUC_OPEN_RO);
 	if(r != DUC_OK) {
@@ -32,35 +31,37 @@ static int info_db(duc *duc, char *file)
 	}
 
 	printf("Date       Time       Files    Dirs    Size Path\n");
-	while(( report = duc_get_report(duc, i)) != NULL) {
+	duc_catalog *cat = duc_catalog_open(duc);
+	while(( info = duc_catalog_read(cat)) != NULL) {
 
 		char ts[32];
-		time_t t = report->time_start.tv_sec;
+		time_t t = info->time_start.tv_sec;
 		struct tm *tm = localtime(&t);
 		strftime(ts, sizeof ts, "%Y-%m-%d %H:%M:%S",tm);
 
 		char siz[32], fs[32], ds[32];
-		duc_human_size(&report->size, st, opt_bytes, siz, sizeof siz);
-		duc_human_number(report->file_count, opt_bytes, fs, sizeof fs);
-		duc_human_number(report->dir_count, opt_bytes, ds, sizeof ds);
+		duc_human_size(&info->size, st, opt_bytes, siz, sizeof siz);
+		duc_human_number(info->file_count, opt_bytes, fs, sizeof fs);
+		duc_human_number(info->dir_count, opt_bytes, ds, sizeof ds);
 
-		printf("%s %7s %7s %7s %s\n", ts, fs, ds, siz, report->path);
+		printf("%s %7s %7s %7s %s\n", ts, fs, ds, siz, info->path);
 
-		if (opt_histogram) {
-		    size_t count;
+		duc_report *report;
+		if (opt_histogram && (report = duc_catalog_get_report(cat)) != NULL) {
+		    size_t count, buckets;
+		    const size_t *histogram = duc_report_get_histogram(report, &buckets);
 		    setlocale(LC_NUMERIC, "");
 		    printf("\nHistogram:\n----------\n");
-		    for (int i=0; i < report->histogram_buckets; i++) {
-			count = report->histogram[i];
+		    for (int i=0; i < buckets; i++) {
+			count = histogram[i];
 			if (count != 0) {
 			    printf("2^%-02d  %'d\n",i, count);
 			}
 		    }
+		    duc_report_close(report);
 		}
-		
-		duc_index_report_free(report);
-		i++;
 	}
+	duc_catalog_close(cat);
 
 	duc_close(duc);
 
@@ -21,12 +21,12 @@ static char *opt_database = NULL;
 
 static int topn_db(duc *duc, char *file)
 {
-	struct duc_index_report *report;
+	duc_report *report;
 	duc_size_type st = DUC_SIZE_TYPE_ACTUAL;
 	duc_sort sort = DUC_SORT_SIZE;
 
 	// We can have multiple reports in a single DB... needs more testing.
-	int rep_idx = 0;
+	duc_catalog *cat;
 
 	int r = duc_open(duc, file, DUC_OPEN_RO);
 	if(r != DUC_OK) {
@@ -35,16 +35,20 @@ static int topn_db(duc *duc, char *file)
 	}
 
 	printf("%*s Filename\n",12,"Size");
-	while(( report = duc_get_report(duc, rep_idx)) != NULL) {
+	cat = duc_catalog_open(duc);
+	while(duc_catalog_read(cat) != NULL) {
+
+	    if((report = duc_catalog_get_report(cat)) == NULL) continue;
 
 	    size_t count;
 	    // Get number of topN files actually stored in report.
-	    int topn_cnt = report->topn_cnt;
+	    const duc_topn_file *topn = duc_report_get_topn(report, &count);
+	    int topn_cnt = count;
 
 	    setlocale(LC_NUMERIC, "");
 	    // Counting DOWN from largest to smallest, assumes array already sorted.
 	    for (int idx=topn_cnt-1; idx >= 0; idx--) {
-		size_t size = report->topn_array[idx]->size;
+		size_t size = topn[idx].size;
 		if ( size != 0) {
 		    // FIXME - replace 32 with correct #define
 		    char siz[32];
@@ -53,13 +57,13 @@ static int topn_db(duc *duc, char *file)
 		    duc_human_size(&dsize, st, opt_bytes, siz, sizeof siz);
 		    // FIXME - replace 12 with correct #define
 		    printf("%*s", 12, siz);
-		    printf(" %s\n", report->topn_array[idx]->name);
+		    printf(" %s\n", topn[idx].name);
 		}
 	    }
 			
-	    duc_index_report_free(report);
-	    rep_idx++;
+	    duc_report_close(report);
 	}
+	duc_catalog_close(cat);
 
 	duc_close(duc);
 	
@@ -126,15 +126,20 @@ static duc_dir *do_dir(duc *duc, duc_dir *dir, int depth)
 		mvhline(0, 0, ' ', cols);
 		if (opt_topn) {
 		    // We can have more than one report in DB...
-		    int rep_idx = 0;
 		    int topn_cnt = 0;
-		    struct duc_index_report *report;
+		    duc_report *report = NULL;
+		    duc_catalog *cat = duc_catalog_open(duc);
 
 		    // FIXME - only gets last report data
-		    while(( report = duc_get_report(duc, rep_idx)) != NULL) {
-			topn_cnt = report->topn_cnt;
-			rep_idx++;
+		    while(duc_catalog_read(cat) != NULL) ;
+		    report = duc_catalog_get_report(cat);
+		    if(report) {
+			size_t count;
+			duc_report_get_topn(report, &count);
+			topn_cnt = count;
+			duc_report_close(report);
 		    }
+		    duc_catalog_close(cat);
 		    mvprintw(0, 1, " %d largest files", topn_cnt);
 		}
 		else {
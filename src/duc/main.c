@@ -76,9 +76,13 @@ static int opt_verbose = 0;
 static int opt_quiet = 0;
 static int opt_help = 0;
 static int opt_version = 0;
+static int opt_cache_size = DUC_CACHE_SIZE_DEF / (1024 * 1024);
 
 
 static struct ducrc_option global_options[] = {
+	{ &opt_cache_size, "cache-size", 0, DUCRC_TYPE_INT,  "use VAL megabytes for caching directories",
+	  "directories read from the database are kept in memory, so redrawing the graph or going back to a "
+	  "directory does not read them again. 0 disables the cache. Defaults to 32" },
 	{ &opt_debug,    "debug",      0, DUCRC_TYPE_BOOL,   "increase verbosity to debug level" },
 	{ &opt_help,     "help",     'h', DUCRC_TYPE_BOOL,   "show help" },
 	{ &opt_quiet,    "quiet",    'q', DUCRC_TYPE_BOOL,   "quiet mode, do not print any warning" },
@@ -177,6 +181,10 @@ int main(int argc, char **argv)
 	if(opt_debug) log_level = DUC_LOG_DMP;
 	duc_set_log_level(duc, log_level);
 
+	if(opt_cache_size >= 0) {
+		duc_set_cache_size(duc, (size_t)opt_cache_size * 1024 * 1024);
+	}
+
 
 	/* Handle command */
 
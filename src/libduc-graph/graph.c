@@ -252,16 +252,24 @@ static int do_dir(duc_graph *g, duc_dir *dir, int level, double r1, double a1_di
 	off_t size_min = size_total;
 	off_t size_max = 0;
 
-	while( (e = duc_dir_read(dir, g->size_type, DUC_SORT_SIZE)) != NULL) {
+	duc_dir_rewind(dir);
+	while( (e = duc_dir_read(dir, g->size_type, DUC_SORT_NAME)) != NULL) {
 		off_t size = duc_get_size(&e->size, g->size_type);
 		if(size < size_min) size_min = size;
 		if(size > size_max) size_max = size;
 	}
 
-	/* Rewind and iterate the objects to graph */
+	/* Iterate the objects to graph. Segments smaller than one pixel are
+	 * skipped, so no more than one per pixel along the outer edge of the
+	 * ring fits in the range of this directory */
 
-	duc_dir_rewind(dir);
-	while( (e = duc_dir_read(dir, g->size_type, DUC_SORT_SIZE)) != NULL) {
+	size_t i, count;
+	size_t k = a_range * M_PI * g->size + 1;
+	struct duc_dirent **list = duc_dir_read_topk(dir, g->size_type, k, &count);
+
+	for(i=0; i<count; i++) {
+
+		e = list[i];
 
 		/* size_rel is size relative to total, size_nrel is size relative to min and max */
 
@@ -1,6 +1,7 @@
 
 #include "config.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -9,6 +10,7 @@
 
 #include "private.h"
 #include "buffer.h"
+#include "catalog.h"
 #include "varint.h"
 
 
@@ -23,6 +25,7 @@ struct buffer *buffer_new(void *data, size_t len)
 
 	b = duc_malloc(sizeof(struct buffer));
 	b->ptr = 0;
+	b->borrowed = 0;
 
 	if(data) {
 		b->max = len;
@@ -38,9 +41,22 @@ struct buffer *buffer_new(void *data, size_t len)
 }
 
 
+/*
+ * Buffer for reading memory owned by the caller, which is left alone by
+ * buffer_free()
+ */
+
+struct buffer *buffer_new_view(const void *data, size_t len)
+{
+	struct buffer *b = buffer_new((void *)data, len);
+	b->borrowed = 1;
+	return b;
+}
+
+
 void buffer_free(struct buffer *b)
 {
-	duc_free(b->data);
+	if(!b->borrowed) duc_free(b->data);
 	duc_free(b);
 }
 
@@ -84,22 +100,43 @@ static int buffer_put_varint(struct buffer *b, uint64_t v)
 
 static int buffer_get_varint(struct buffer *b, uint64_t *v)
 {
-	uint8_t buf[9];
-	int r = buffer_get(b, buf, 1);
-	if(r == 0) return 0;
-
-	int n = 0;
-	if(buf[0] >= 249) {
-		n = buf[0] - 247;
-	} else if(buf[0] >= 241) {
-		n = 1;
+	size_t left = b->len - b->ptr;
+	if(left == 0) return 0;
+
+	const uint8_t *p = b->data + b->ptr;
+	if(p[0] <= 240) {
+		*v = p[0];
+		b->ptr ++;
+		return 1;
 	}
-	if(n > 0) buffer_get(b, buf+1, n);
-	int l = GetVarint64(buf, n+1, v);
+
+	int l = GetVarint64(p, left < 9 ? left : 9, v);
+	b->ptr += l;
 	return l;
 }
 
 
+/*
+ * Decode a column of count varints, storing each value times mul in the
+ * duc_size field at offset off of the entries
+ */
+
+static void buffer_get_size_column(struct buffer *b, struct duc_dirent *ent_list, size_t count, size_t off, uint64_t mul)
+{
+	uint64_t v[256];
+	size_t i, j, n;
+
+	for(i=0; i<count; i+=n) {
+		n = count - i < 256 ? count - i : 256;
+		b->ptr += GetVarint64Bulk(b->data + b->ptr, b->len - b->ptr, v, n);
+		for(j=0; j<n; j++) {
+			off_t *field = (off_t *)((char *)&ent_list[i+j].size + off);
+			*field = v[j] * mul;
+		}
+	}
+}
+
+
 static void buffer_put_string(struct buffer *b, const char *s)
 {
 	size_t len = strlen(s);
@@ -118,7 +155,7 @@ static void buffer_put_string(struct buffer *b, const char *s)
 // Maximum string size of 255 bytes... why?
 static void buffer_get_string(struct buffer *b, char **sout)
 {
-	uint8_t len;
+	uint8_t len = 0;
 	buffer_get(b, &len, sizeof(len));
 	char *s = duc_malloc(len + 1);
 	if(s) {
@@ -161,46 +198,512 @@ static void buffer_get_size(struct buffer *b, struct duc_size *size)
 }
 
 
+static uint64_t zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+
+static int64_t unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+
 /*
- * Serialize data from structs into buffer
+ * Directory record:
+ *
+ *   header   parent devino, mtime, flags, entry count and size totals
+ *   ranks    position of each entry when sorted by actual size, as used by
+ *            the default listing
+ *   names    byte length of the block, then for each entry the length of
+ *            the prefix shared with the previous name and the suffix
+ *            length, packed in one byte when they fit in four bits or
+ *            else following a 0xff byte, and the suffix
+ *   columns  entry types as bytes, the apparent, actual and count varints
+ *            and the dev and inode of the directory entries as zigzag
+ *            deltas of the previous one
+ *
+ * Entries are stored sorted by name to make the shared prefixes as long as
+ * possible. The ranks let readers put the entries in the default size
+ * order without sorting them. Keeping each field in its own column lets the sizes be decoded
+ * in bulk without walking the names.
  */
 
-void buffer_put_dir(struct buffer *b, const struct duc_devino *devino, time_t mtime)
+struct ent_rank {
+	const struct duc_dirent *ent;
+	size_t idx;
+};
+
+
+static int fn_comp_name(const void *a, const void *b)
 {
-	buffer_put_devino(b, devino);
+	const struct duc_dirent * const *ea = a;
+	const struct duc_dirent * const *eb = b;
+	return strcmp((*ea)->name, (*eb)->name);
+}
+
+
+static int fn_comp_rank(const void *a, const void *b)
+{
+	const struct ent_rank *ra = a;
+	const struct ent_rank *rb = b;
+	return duc_dirent_cmp_actual(ra->ent, rb->ent);
+}
+
+
+void buffer_put_dir(struct buffer *b, const struct duc_devino *devino_parent, time_t mtime,
+		const struct duc_dirent **ent_list, size_t count)
+{
+	struct duc_size total = { 0, 0, 0 };
+	int flags = DIR_FLAG_ACTUAL_BLOCKS;
+	size_t i;
+
+	qsort(ent_list, count, sizeof(*ent_list), fn_comp_name);
+	if(count > 1) flags |= DIR_FLAG_RANK_ACTUAL;
+
+	for(i=0; i<count; i++) {
+		duc_size_accum(&total, &ent_list[i]->size);
+		if(ent_list[i]->size.actual % 512) flags &= ~DIR_FLAG_ACTUAL_BLOCKS;
+	}
+
+	buffer_put_devino(b, devino_parent);
 	buffer_put_varint(b, mtime);
+	buffer_put_varint(b, flags);
+	buffer_put_varint(b, count);
+	buffer_put_size(b, &total);
+
+	/* Ranks */
+
+	if(flags & DIR_FLAG_RANK_ACTUAL) {
+		struct ent_rank *order = duc_malloc(count * sizeof(*order));
+		size_t *rank = duc_malloc(count * sizeof(*rank));
+		for(i=0; i<count; i++) {
+			order[i].ent = ent_list[i];
+			order[i].idx = i;
+		}
+		qsort(order, count, sizeof(*order), fn_comp_rank);
+		for(i=0; i<count; i++) {
+			rank[order[i].idx] = i;
+		}
+		for(i=0; i<count; i++) {
+			buffer_put_varint(b, rank[i]);
+		}
+		duc_free(rank);
+		duc_free(order);
+	}
+
+	/* Names */
+
+	struct buffer *names = buffer_new(NULL, 0);
+	const char *prev = "";
+
+	for(i=0; i<count; i++) {
+		const char *name = ent_list[i]->name;
+		size_t len = strlen(name);
+		size_t shared = 0;
+		if(len > 255) {
+			fprintf(stderr,"cannot buffer_put_dir() names larger than 255 bytes\n");
+			exit(1);
+		}
+		while(prev[shared] && prev[shared] == name[shared]) shared ++;
+		uint8_t suffix = len - shared;
+		if(shared < 15 && suffix < 16) {
+			uint8_t l = (shared << 4) | suffix;
+			buffer_put(names, &l, sizeof l);
+		} else {
+			uint8_t l[3] = { 0xff, shared, suffix };
+			buffer_put(names, l, sizeof l);
+		}
+		buffer_put(names, name + shared, suffix);
+		prev = name;
+	}
+
+	buffer_put_varint(b, names->len);
+	buffer_put(b, names->data, names->len);
+	buffer_free(names);
+
+	/* Columns */
+
+	for(i=0; i<count; i++) {
+		uint8_t type = ent_list[i]->type;
+		buffer_put(b, &type, sizeof type);
+	}
+	for(i=0; i<count; i++) {
+		buffer_put_varint(b, ent_list[i]->size.apparent);
+	}
+	for(i=0; i<count; i++) {
+		uint64_t actual = ent_list[i]->size.actual;
+		if(flags & DIR_FLAG_ACTUAL_BLOCKS) actual /= 512;
+		buffer_put_varint(b, actual);
+	}
+	for(i=0; i<count; i++) {
+		buffer_put_varint(b, ent_list[i]->size.count);
+	}
+
+	struct duc_devino prev_devino = *devino_parent;
+	for(i=0; i<count; i++) {
+		const struct duc_devino *devino = &ent_list[i]->devino;
+		if(ent_list[i]->type != DUC_FILE_TYPE_DIR) continue;
+		buffer_put_varint(b, zigzag(devino->dev - prev_devino.dev));
+		buffer_put_varint(b, zigzag(devino->ino - prev_devino.ino));
+		prev_devino = *devino;
+	}
 }
 
 
-void buffer_get_dir(struct buffer *b, struct duc_devino *devino, time_t *mtime)
+/*
+ * Read the record header. With rows set the record is in the pre version
+ * 19 format, which only holds the parent devino and mtime; the count and
+ * totals are filled in by buffer_get_dirents().
+ */
+
+void buffer_get_dir(struct buffer *b, struct dir_header *h, int rows)
 {
 	uint64_t v;
-	buffer_get_devino(b, devino);
-	buffer_get_varint(b, &v); *mtime = v;
+
+	memset(h, 0, sizeof(*h));
+	buffer_get_devino(b, &h->devino_parent);
+	buffer_get_varint(b, &v); h->mtime = v;
+
+	if(rows) {
+		h->flags = DIR_FLAG_ROWS;
+		return;
+	}
+
+	buffer_get_varint(b, &v); h->flags = v;
+	buffer_get_varint(b, &v); h->count = v;
+	buffer_get_size(b, &h->size);
+
+	/* Every entry takes at least four bytes */
+	if(h->count > (b->len - b->ptr) / 4) h->count = 0;
 }
 
-void buffer_put_dirent(struct buffer *b, const struct duc_dirent *ent)
+
+/*
+ * Move the entries of a list with separately allocated names into a single
+ * allocation holding both the entries and the names
+ */
+
+static struct duc_dirent *dirents_pack(struct duc_dirent *ent_list, size_t count)
 {
-	buffer_put_string(b, ent->name);
-	buffer_put_size(b, &ent->size);
-	buffer_put_varint(b, ent->type);
+	size_t names_len = 0;
+	size_t i;
+
+	for(i=0; i<count; i++) {
+		names_len += strlen(ent_list[i].name) + 1;
+	}
+
+	size_t ents_len = (count + 1) * sizeof(*ent_list);
+	struct duc_dirent *packed = duc_malloc(ents_len + names_len);
+	char *p = (char *)packed + ents_len;
 
-	if(ent->type == DUC_FILE_TYPE_DIR) {
-		buffer_put_devino(b, &ent->devino);
+	for(i=0; i<count; i++) {
+		size_t l = strlen(ent_list[i].name) + 1;
+		packed[i] = ent_list[i];
+		packed[i].name = memcpy(p, ent_list[i].name, l);
+		p += l;
+		duc_free(ent_list[i].name);
 	}
+
+	duc_free(ent_list);
+	return packed;
 }
 
-void buffer_get_dirent(struct buffer *b, struct duc_dirent *ent)
+
+static struct duc_dirent *buffer_get_dirent_rows(struct buffer *b, struct dir_header *h)
 {
+	struct duc_dirent *ent_list = NULL;
+	size_t max = 0;
 	uint64_t v;
 
-	buffer_get_string(b, &ent->name);
-	buffer_get_size(b, &ent->size);
-	buffer_get_varint(b, &v); ent->type = v;
-	
-	if(ent->type == DUC_FILE_TYPE_DIR) {
-		buffer_get_devino(b, &ent->devino);
+	h->count = 0;
+
+	while(b->ptr < b->len) {
+		if(h->count == max) {
+			max = max ? max * 2 : 32;
+			ent_list = duc_realloc(ent_list, max * sizeof(*ent_list));
+		}
+		struct duc_dirent *ent = &ent_list[h->count++];
+		memset(ent, 0, sizeof(*ent));
+		buffer_get_string(b, &ent->name);
+		buffer_get_size(b, &ent->size);
+		buffer_get_varint(b, &v); ent->type = v;
+		if(ent->type == DUC_FILE_TYPE_DIR) {
+			buffer_get_devino(b, &ent->devino);
+		}
+		duc_size_accum(&h->size, &ent->size);
 	}
+
+	return dirents_pack(ent_list, h->count);
+}
+
+
+/*
+ * Read the shared prefix and suffix lengths of a name, returns NULL when
+ * they do not fit before end
+ */
+
+static const uint8_t *get_name_len(const uint8_t *p, const uint8_t *end, size_t *shared, size_t *suffix)
+{
+	if(p >= end) return NULL;
+
+	if(*p == 0xff) {
+		if(end - p < 3) return NULL;
+		*shared = p[1];
+		*suffix = p[2];
+		p += 3;
+	} else {
+		*shared = *p >> 4;
+		*suffix = *p & 0x0f;
+		p += 1;
+	}
+
+	if((size_t)(end - p) < *suffix) return NULL;
+	return p;
+}
+
+
+/*
+ * Read the ranks, returns NULL if the record has none or they are not a
+ * permutation of the entries
+ */
+
+static uint64_t *buffer_get_ranks(struct buffer *b, struct dir_header *h)
+{
+	size_t count = h->count;
+	size_t i;
+
+	if(!(h->flags & DIR_FLAG_RANK_ACTUAL)) return NULL;
+
+	uint64_t *rank = duc_malloc((count + 1) * sizeof(*rank));
+	uint8_t *seen = duc_malloc0(count + 1);
+
+	b->ptr += GetVarint64Bulk(b->data + b->ptr, b->len - b->ptr, rank, count);
+
+	for(i=0; i<count; i++) {
+		if(rank[i] >= count || seen[rank[i]]) break;
+		seen[rank[i]] = 1;
+	}
+	duc_free(seen);
+
+	if(i < count) {
+		duc_free(rank);
+		h->flags &= ~DIR_FLAG_RANK_ACTUAL;
+		return NULL;
+	}
+
+	return rank;
+}
+
+
+/*
+ * Decode the entries following the header into a newly allocated array of
+ * h->count entries. The names are stored in the same allocation, so the
+ * list is freed with a single duc_free(). The list is sorted by name; if
+ * rank is given and the record holds the ranks by actual size, they are
+ * returned in a newly allocated array, or else rank is set to NULL.
+ */
+
+struct duc_dirent *buffer_get_dirents(struct buffer *b, struct dir_header *h, uint64_t **rank_out)
+{
+	size_t count = h->count;
+	uint64_t v;
+	size_t i;
+
+	if(rank_out) *rank_out = NULL;
+
+	if(h->flags & DIR_FLAG_ROWS) {
+		return buffer_get_dirent_rows(b, h);
+	}
+
+	uint64_t *rank = buffer_get_ranks(b, h);
+
+	buffer_get_varint(b, &v);
+	size_t names_end = b->ptr + v;
+	if(v > b->len - b->ptr) names_end = b->len;
+
+	const uint8_t *names = b->data + b->ptr;
+	const uint8_t *end = b->data + names_end;
+	const uint8_t *p;
+
+	/* Find the size of the decoded names first. Entries after a corrupt
+	 * name all share the empty string at the end of the arena */
+
+	size_t names_len = 0;
+	size_t name_len = 0;
+	size_t valid = 0;
+	size_t shared = 0, suffix = 0;
+
+	for(p=names; valid<count; valid++) {
+		p = get_name_len(p, end, &shared, &suffix);
+		if(p == NULL || shared > name_len) break;
+		name_len = shared + suffix;
+		names_len += name_len + 1;
+		p += suffix;
+	}
+
+	size_t ents_len = (count + 1) * sizeof(struct duc_dirent);
+	struct duc_dirent *ent_list = duc_malloc0(ents_len + names_len + 1);
+	char *arena = (char *)ent_list + ents_len;
+	char *prev = arena;
+
+	for(p=names, i=0; i<valid; i++) {
+		p = get_name_len(p, end, &shared, &suffix);
+		if(p == NULL) break;
+		memcpy(arena, prev, shared);
+		memcpy(arena + shared, p, suffix);
+		arena[shared + suffix] = '\0';
+		ent_list[i].name = prev = arena;
+		arena += shared + suffix + 1;
+		p += suffix;
+	}
+	for(; i<count; i++) {
+		ent_list[i].name = arena;
+	}
+
+	b->ptr = names_end;
+
+	/* Columns */
+
+	for(i=0; i<count; i++) {
+		uint8_t type = 0;
+		buffer_get(b, &type, sizeof type);
+		ent_list[i].type = type;
+	}
+	buffer_get_size_column(b, ent_list, count, offsetof(struct duc_size, apparent), 1);
+	buffer_get_size_column(b, ent_list, count, offsetof(struct duc_size, actual),
+			(h->flags & DIR_FLAG_ACTUAL_BLOCKS) ? 512 : 1);
+	buffer_get_size_column(b, ent_list, count, offsetof(struct duc_size, count), 1);
+
+	struct duc_devino devino = h->devino_parent;
+	for(i=0; i<count; i++) {
+		struct duc_dirent *ent = &ent_list[i];
+		if(ent->type != DUC_FILE_TYPE_DIR) continue;
+		buffer_get_varint(b, &v); devino.dev += unzigzag(v);
+		buffer_get_varint(b, &v); devino.ino += unzigzag(v);
+		ent->devino = devino;
+	}
+
+	if(rank_out) {
+		*rank_out = rank;
+	} else {
+		duc_free(rank);
+	}
+
+	return ent_list;
+}
+
+
+/*
+ * Histogram record: number of buckets followed by the counts. Trailing
+ * empty buckets are not stored.
+ */
+
+void buffer_put_histogram(struct buffer *b, const size_t *histogram, int buckets)
+{
+	int i;
+
+	while(buckets > 0 && histogram[buckets-1] == 0) buckets --;
+
+	buffer_put_varint(b, buckets);
+	for(i=0; i<buckets; i++) {
+		buffer_put_varint(b, histogram[i]);
+	}
+}
+
+
+/*
+ * Read histogram into an array of the given number of buckets, returns the
+ * number of buckets stored
+ */
+
+int buffer_get_histogram(struct buffer *b, size_t *histogram, int buckets)
+{
+	uint64_t n, v;
+	int i;
+
+	memset(histogram, 0, buckets * sizeof(*histogram));
+
+	buffer_get_varint(b, &n);
+	for(i=0; i<(int)n; i++) {
+		buffer_get_varint(b, &v);
+		if(i < buckets) histogram[i] = v;
+	}
+
+	return n;
+}
+
+
+void buffer_put_path_entry(struct buffer *b, const struct path_entry *pe)
+{
+	buffer_put_devino(b, &pe->devino);
+	buffer_put_varint(b, pe->stamp);
+	buffer_put_varint(b, pe->root_len);
+}
+
+
+void buffer_get_path_entry(struct buffer *b, struct path_entry *pe)
+{
+	uint64_t v = 0;
+
+	memset(pe, 0, sizeof(*pe));
+	buffer_get_devino(b, &pe->devino);
+	buffer_get_varint(b, &pe->stamp);
+	buffer_get_varint(b, &v); pe->root_len = v;
+}
+
+
+/*
+ * Report catalog entry: path length and path followed by the summary of
+ * the report
+ */
+
+void buffer_put_report_info(struct buffer *b, const struct duc_report_info *info)
+{
+	size_t len = strlen(info->path);
+
+	buffer_put_varint(b, len);
+	buffer_put(b, info->path, len);
+	buffer_put_devino(b, &info->devino);
+	buffer_put_varint(b, info->time_start.tv_sec);
+	buffer_put_varint(b, info->time_start.tv_usec);
+	buffer_put_varint(b, info->time_stop.tv_sec);
+	buffer_put_varint(b, info->time_stop.tv_usec);
+	buffer_put_varint(b, info->file_count);
+	buffer_put_varint(b, info->dir_count);
+	buffer_put_size(b, &info->size);
+}
+
+
+/*
+ * Decode a catalog entry, the path is allocated. Returns 0 at the end of
+ * the buffer or when the entry is truncated.
+ */
+
+int buffer_get_report_info(struct buffer *b, struct duc_report_info *info)
+{
+	uint64_t len, v;
+
+	memset(info, 0, sizeof(*info));
+	if(buffer_get_varint(b, &len) == 0) return 0;
+	if(len > b->len - b->ptr) return 0;
+
+	char *path = duc_malloc(len + 1);
+	buffer_get(b, path, len);
+	path[len] = '\0';
+	info->path = path;
+
+	buffer_get_devino(b, &info->devino);
+	buffer_get_varint(b, &v); info->time_start.tv_sec = v;
+	buffer_get_varint(b, &v); info->time_start.tv_usec = v;
+	buffer_get_varint(b, &v); info->time_stop.tv_sec = v;
+	buffer_get_varint(b, &v); info->time_stop.tv_usec = v;
+	buffer_get_varint(b, &v); info->file_count = v;
+	buffer_get_varint(b, &v); info->dir_count = v;
+	buffer_get_size(b, &info->size);
+
+	return 1;
 }
 
 
@@ -227,52 +730,112 @@ void buffer_put_index_report(struct buffer *b, const struct duc_index_report *re
 	    buffer_put_varint(b,report->histogram[i]);
 	}
 
-	/* write topN data, FIXME */
+	/* write topN data, see buffer_get_name() for the name format */
 	for(int i = 0; i < report->topn_cnt; i++) {
-	    buffer_put_varint(b, strlen(report->topn_array[i]->name));
-	    buffer_put_string(b, report->topn_array[i]->name);
-	    buffer_put_varint(b, report->topn_array[i]->size);
+	    size_t len = strlen(report->topn_array[i].name);
+	    buffer_put_varint(b, len + REPORT_NAME_RAW);
+	    buffer_put(b, report->topn_array[i].name, len);
+	    buffer_put_varint(b, report->topn_array[i].size);
 	}
+
+	buffer_put_varint(b, report->hard_link_mem_peak);
+	buffer_put_varint(b, report->write_queue_peak);
+	buffer_put_varint(b, report->write_stall.tv_sec);
+	buffer_put_varint(b, report->write_stall.tv_usec);
+	buffer_put_varint(b, report->options_hash);
 }
 
-/* must have identical layout as buffer_put_index_report()! */
-void buffer_get_index_report(struct buffer *b, struct duc_index_report *report)
+/*
+ * Decode a report written by buffer_put_index_report(). The histogram and
+ * topN list are sized to what is stored; the topN names share a single
+ * allocation.
+ */
+
+/*
+ * TopN names are stored as REPORT_NAME_RAW plus the length, followed by
+ * the name. Older records have the plain length, always below 256, followed
+ * by a length prefixed string.
+ */
+
+static void buffer_get_name(struct buffer *b, char *s)
 {
-	char *vs = NULL;
-	buffer_get_string(b, &vs);
-	if(vs == NULL) return;
+	uint64_t v = 0;
+	size_t len;
+
+	buffer_get_varint(b, &v);
+	if(v >= REPORT_NAME_RAW) {
+		len = v - REPORT_NAME_RAW;
+	} else {
+		uint8_t l = 0;
+		buffer_get(b, &l, sizeof(l));
+		len = l;
+	}
+	if(len > b->len - b->ptr || buffer_get(b, s, len) == 0) len = 0;
+	s[len] = '\0';
+}
 
-	snprintf(report->path, sizeof(report->path), "%s", vs);
-	duc_free(vs);
 
+void buffer_get_report(struct buffer *b, struct duc_report *r)
+{
 	uint64_t vi;
-	buffer_get_devino(b, &report->devino);
-	buffer_get_varint(b, &vi); report->time_start.tv_sec = vi;
-	buffer_get_varint(b, &vi); report->time_start.tv_usec = vi;
-	buffer_get_varint(b, &vi); report->time_stop.tv_sec = vi;
-	buffer_get_varint(b, &vi); report->time_stop.tv_usec = vi;
-	buffer_get_varint(b, &vi); report->file_count = vi;
-	buffer_get_varint(b, &vi); report->dir_count = vi;
-	buffer_get_size(b, &report->size);
-        /* read topN data as well, if found */
-	buffer_get_varint(b, &vi); report->topn_min_size = vi;
-	buffer_get_varint(b, &vi); report->topn_cnt = vi;
-	buffer_get_varint(b, &vi); report->topn_cnt_max = vi;
-	buffer_get_varint(b, &vi); report->histogram_buckets = vi;
-
-	/* when reading, look for -1 as last bucket, so we can be dynamically sized? */
-	for(int i = 0; i < report->histogram_buckets; i++) {
-	    buffer_get_varint(b, &vi);
-	    report->histogram[i] = vi;
+	uint8_t len = 0;
+	size_t left;
+	size_t i;
+
+	memset(r, 0, sizeof(*r));
+
+	buffer_get(b, &len, sizeof(len));
+	char *path = duc_malloc(len + 1);
+	if(buffer_get(b, path, len) == 0) len = 0;
+	path[len] = '\0';
+	r->info.path = path;
+
+	buffer_get_devino(b, &r->info.devino);
+	buffer_get_varint(b, &vi); r->info.time_start.tv_sec = vi;
+	buffer_get_varint(b, &vi); r->info.time_start.tv_usec = vi;
+	buffer_get_varint(b, &vi); r->info.time_stop.tv_sec = vi;
+	buffer_get_varint(b, &vi); r->info.time_stop.tv_usec = vi;
+	buffer_get_varint(b, &vi); r->info.file_count = vi;
+	buffer_get_varint(b, &vi); r->info.dir_count = vi;
+	buffer_get_size(b, &r->info.size);
+	buffer_get_varint(b, &vi); r->topn_min_size = vi;
+	buffer_get_varint(b, &vi); r->topn_cnt = vi;
+	buffer_get_varint(b, &vi); r->topn_cnt_max = vi;
+	buffer_get_varint(b, &vi); r->histogram_buckets = vi;
+
+	/* Every value takes at least one byte, which bounds the counts of
+	 * damaged records */
+
+	left = b->len - b->ptr;
+	if(r->histogram_buckets > left) r->histogram_buckets = left;
+	r->histogram = duc_malloc0((r->histogram_buckets + 1) * sizeof(*r->histogram));
+	for(i=0; i<r->histogram_buckets; i++) {
+		buffer_get_varint(b, &vi);
+		r->histogram[i] = vi;
 	}
 
-	for(int i = 0; i < report->topn_cnt; i++) {
-	    uint64_t length;
-	    buffer_get_varint(b, &length);
-	    buffer_get_string(b, &vs);
-	    report->topn_array[i] = duc_malloc0(sizeof(duc_topn_file));
-	    strncpy(report->topn_array[i]->name, vs, strlen(vs));
-	    buffer_get_varint(b, &vi); report->topn_array[i]->size = vi;
+	left = b->len - b->ptr;
+	if(r->topn_cnt > left / 3) r->topn_cnt = left / 3;
+	r->topn = duc_malloc0((r->topn_cnt + 1) * sizeof(*r->topn));
+	char *name = r->topn_names = duc_malloc(left + 1);
+	for(i=0; i<r->topn_cnt; i++) {
+		buffer_get_name(b, name);
+		r->topn[i].name = name;
+		name += strlen(name) + 1;
+		buffer_get_varint(b, &vi); r->topn[i].size = vi;
+	}
+
+	/* Added later, older databases end here */
+	if(b->ptr < b->len) {
+		buffer_get_varint(b, &vi); r->hard_link_mem_peak = vi;
+	}
+	if(b->ptr < b->len) {
+		buffer_get_varint(b, &vi); r->write_queue_peak = vi;
+		buffer_get_varint(b, &vi); r->write_stall.tv_sec = vi;
+		buffer_get_varint(b, &vi); r->write_stall.tv_usec = vi;
+	}
+	if(b->ptr < b->len) {
+		buffer_get_varint(b, &vi); r->options_hash = vi;
 	}
 }
 
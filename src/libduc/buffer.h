@@ -6,18 +6,51 @@ struct buffer {
 	size_t max;
 	size_t len;
 	size_t ptr;
+	int borrowed;               /* data is not ours to free */
+};
+
+/* Directory record header flags */
+#define DIR_FLAG_ROWS (1<<0)          /* Pre version 19 record, one row per entry */
+#define DIR_FLAG_ACTUAL_BLOCKS (1<<1) /* Actual sizes stored in 512 byte units */
+#define DIR_FLAG_RANK_ACTUAL (1<<2)   /* Record holds the rank of each entry by actual size */
+
+struct dir_header {
+	struct duc_devino devino_parent;
+	time_t mtime;
+	int flags;
+	size_t count;               /* Number of entries */
+	struct duc_size size;       /* Sum of the entry sizes */
+};
+
+/* Added to the length of the topN names in reports */
+#define REPORT_NAME_RAW 256
+
+/* Path index entry, stored under the path of a directory */
+struct path_entry {
+	struct duc_devino devino;
+	uint64_t stamp;             /* Start time of the index run in microseconds */
+	size_t root_len;            /* Length of the path indexed by that run */
 };
 
 struct buffer *buffer_new(void *data, size_t len);
+struct buffer *buffer_new_view(const void *data, size_t len);
 void buffer_free(struct buffer *b);
 
-void buffer_put_dir(struct buffer *b, const struct duc_devino *devino, time_t mtime);
-void buffer_get_dir(struct buffer *b, struct duc_devino *devino, time_t *mtime);
+void buffer_put_dir(struct buffer *b, const struct duc_devino *devino_parent, time_t mtime,
+		const struct duc_dirent **ent_list, size_t count);
+void buffer_get_dir(struct buffer *b, struct dir_header *h, int rows);
+struct duc_dirent *buffer_get_dirents(struct buffer *b, struct dir_header *h, uint64_t **rank);
+
+void buffer_put_histogram(struct buffer *b, const size_t *histogram, int buckets);
+int buffer_get_histogram(struct buffer *b, size_t *histogram, int buckets);
+
+void buffer_put_path_entry(struct buffer *b, const struct path_entry *pe);
+void buffer_get_path_entry(struct buffer *b, struct path_entry *pe);
 
-void buffer_put_dirent(struct buffer *b, const struct duc_dirent *ent);
-void buffer_get_dirent(struct buffer *b, struct duc_dirent *ent);
+void buffer_put_report_info(struct buffer *b, const struct duc_report_info *info);
+int buffer_get_report_info(struct buffer *b, struct duc_report_info *info);
 
 void buffer_put_index_report(struct buffer *b, const struct duc_index_report *report);
-void buffer_get_index_report(struct buffer *b, struct duc_index_report *report);
+void buffer_get_report(struct buffer *b, struct duc_report *r);
 
 #endif
@@ -0,0 +1,291 @@
+
+/*
+ * Index reports and the report catalog. The catalog is a single record
+ * under 'duc_report_catalog' holding, for every report, the length and
+ * path followed by its devino, times, counts and size. It is read once and
+ * kept on the duc handle; duc_catalog_read() iterates over it. Databases
+ * without a catalog get one built from the 'duc_index_reports' path array.
+ * Full reports are read into a duc_report, sized to what is stored.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "duc.h"
+#include "private.h"
+#include "db.h"
+#include "buffer.h"
+#include "catalog.h"
+
+#define CATALOG_KEY "duc_report_catalog"
+
+struct catalog {
+	struct duc_report_info *list;
+	size_t count;
+	size_t max;
+};
+
+struct duc_catalog {
+	duc *duc;
+	size_t pos;
+};
+
+
+static void info_set(struct duc_report_info *info, const struct duc_report_info *src)
+{
+	const char *path = info->path;
+	*info = *src;
+	info->path = path;
+}
+
+
+static struct duc_report_info *catalog_add(struct catalog *c, const char *path)
+{
+	if(c->count == c->max) {
+		c->max = c->max ? c->max * 2 : 16;
+		c->list = duc_realloc(c->list, c->max * sizeof(*c->list));
+	}
+	struct duc_report_info *info = &c->list[c->count++];
+	memset(info, 0, sizeof(*info));
+	info->path = path;
+	return info;
+}
+
+
+/*
+ * Build the catalog from the path array of older databases
+ */
+
+static void catalog_read_legacy(duc *duc, struct catalog *c)
+{
+	size_t indexl;
+	size_t i;
+
+	char *index = db_get(duc->db, "duc_index_reports", 17, &indexl);
+	if(index == NULL) return;
+
+	for(i=0; i<indexl / DUC_PATH_MAX; i++) {
+		char *path = index + i * DUC_PATH_MAX;
+		path[DUC_PATH_MAX - 1] = '\0';
+		struct duc_report *report = db_read_report(duc, path);
+		if(report) {
+			info_set(catalog_add(c, duc_strdup(path)), &report->info);
+			duc_report_close(report);
+		}
+	}
+
+	free(index);
+	duc->err = DUC_OK;
+}
+
+
+struct catalog *catalog_get(duc *duc)
+{
+	struct db_view view;
+
+	if(duc->catalog) return duc->catalog;
+
+	struct catalog *c = duc_malloc0(sizeof *c);
+
+	if(db_get_view(duc->db, CATALOG_KEY, strlen(CATALOG_KEY), &view)) {
+		struct buffer *b = buffer_new_view(view.data, view.len);
+		struct duc_report_info info;
+		while(buffer_get_report_info(b, &info)) {
+			*catalog_add(c, info.path) = info;
+		}
+		buffer_free(b);
+		db_release_view(duc->db, &view);
+	} else {
+		catalog_read_legacy(duc, c);
+	}
+
+	duc->catalog = c;
+	return c;
+}
+
+
+void catalog_free(struct catalog *c)
+{
+	size_t i;
+
+	for(i=0; i<c->count; i++) {
+		duc_free((char *)c->list[i].path);
+	}
+	duc_free(c->list);
+	duc_free(c);
+}
+
+
+/*
+ * Add or update the catalog entry of the report and write the catalog
+ */
+
+duc_errno catalog_put(duc *duc, const struct duc_index_report *report)
+{
+	struct catalog *c = catalog_get(duc);
+	struct duc_report_info *info = NULL;
+	size_t i;
+
+	for(i=0; i<c->count; i++) {
+		if(strcmp(c->list[i].path, report->path) == 0) {
+			info = &c->list[i];
+			break;
+		}
+	}
+	if(info == NULL) {
+		info = catalog_add(c, duc_strdup(report->path));
+	}
+	info->devino = report->devino;
+	info->time_start = report->time_start;
+	info->time_stop = report->time_stop;
+	info->file_count = report->file_count;
+	info->dir_count = report->dir_count;
+	info->size = report->size;
+
+	struct buffer *b = buffer_new(NULL, 0);
+	for(i=0; i<c->count; i++) {
+		buffer_put_report_info(b, &c->list[i]);
+	}
+	duc_errno r = db_put(duc->db, CATALOG_KEY, strlen(CATALOG_KEY), b->data, b->len);
+	buffer_free(b);
+
+	return r;
+}
+
+
+/*
+ * Iterate over the reports in the database. The returned entries stay
+ * valid until the database is closed or written.
+ */
+
+duc_catalog *duc_catalog_open(duc *duc)
+{
+	catalog_get(duc);
+
+	duc_catalog *cat = duc_malloc0(sizeof *cat);
+	cat->duc = duc;
+	return cat;
+}
+
+
+const struct duc_report_info *duc_catalog_read(duc_catalog *cat)
+{
+	struct catalog *c = catalog_get(cat->duc);
+
+	if(cat->pos >= c->count) return NULL;
+	return &c->list[cat->pos++];
+}
+
+
+/*
+ * Read the full report of the entry last returned by duc_catalog_read()
+ */
+
+duc_report *duc_catalog_get_report(duc_catalog *cat)
+{
+	struct catalog *c = catalog_get(cat->duc);
+
+	if(cat->pos == 0 || cat->pos > c->count) return NULL;
+	return db_read_report(cat->duc, c->list[cat->pos - 1].path);
+}
+
+
+int duc_catalog_close(duc_catalog *cat)
+{
+	duc_free(cat);
+	return 0;
+}
+
+
+duc_report *duc_report_open(duc *duc, const char *path)
+{
+	return db_read_report(duc, path);
+}
+
+
+const struct duc_report_info *duc_report_get_info(duc_report *report)
+{
+	return &report->info;
+}
+
+
+const size_t *duc_report_get_histogram(duc_report *report, size_t *buckets)
+{
+	*buckets = report->histogram_buckets;
+	return report->histogram;
+}
+
+
+/*
+ * Returns the topN files sorted by size, the largest file last
+ */
+
+const duc_topn_file *duc_report_get_topn(duc_report *report, size_t *count)
+{
+	*count = report->topn_cnt;
+	return report->topn;
+}
+
+
+int duc_report_close(duc_report *report)
+{
+	duc_free((char *)report->info.path);
+	duc_free(report->histogram);
+	duc_free(report->topn);
+	duc_free(report->topn_names);
+	duc_free(report);
+	return 0;
+}
+
+
+/*
+ * Compatibility with the fixed size struct duc_index_report
+ */
+
+struct duc_index_report *duc_get_report(duc *duc, size_t id)
+{
+	struct catalog *c = catalog_get(duc);
+	size_t i;
+
+	if(id >= c->count) return NULL;
+
+	struct duc_report *r = db_read_report(duc, c->list[id].path);
+	if(r == NULL) return NULL;
+
+	struct duc_index_report *report = duc_malloc0(sizeof *report);
+	snprintf(report->path, sizeof(report->path), "%s", r->info.path);
+	report->devino = r->info.devino;
+	report->time_start = r->info.time_start;
+	report->time_stop = r->info.time_stop;
+	report->file_count = r->info.file_count;
+	report->dir_count = r->info.dir_count;
+	report->size = r->info.size;
+	report->topn_min_size = r->topn_min_size;
+	report->topn_cnt_max = r->topn_cnt_max;
+	report->histogram_buckets = r->histogram_buckets;
+	if(report->histogram_buckets > DUC_HISTOGRAM_BUCKETS_MAX) {
+		report->histogram_buckets = DUC_HISTOGRAM_BUCKETS_MAX;
+	}
+	memcpy(report->histogram, r->histogram, report->histogram_buckets * sizeof(*r->histogram));
+	report->topn_cnt = r->topn_cnt;
+	report->topn_array = duc_malloc0((r->topn_cnt + 1) * sizeof(*report->topn_array));
+	for(i=0; i<r->topn_cnt; i++) {
+		report->topn_array[i].name = duc_strdup(r->topn[i].name);
+		report->topn_array[i].size = r->topn[i].size;
+	}
+	report->hard_link_mem_peak = r->hard_link_mem_peak;
+	report->write_queue_peak = r->write_queue_peak;
+	report->write_stall = r->write_stall;
+	report->options_hash = r->options_hash;
+
+	duc_report_close(r);
+	return report;
+}
+
+/*
+ * End
+ */
@@ -0,0 +1,28 @@
+#ifndef catalog_h
+#define catalog_h
+
+#include "duc.h"
+
+/* Report as read from the database, sized to what is stored */
+struct duc_report {
+	struct duc_report_info info;
+	size_t topn_min_size;
+	size_t topn_cnt;
+	size_t topn_cnt_max;
+	size_t histogram_buckets;
+	size_t *histogram;
+	duc_topn_file *topn;        /* Sorted by size, the largest file last */
+	char *topn_names;           /* Storage of the topN names */
+	size_t hard_link_mem_peak;
+	size_t write_queue_peak;
+	struct timeval write_stall;
+	uint64_t options_hash;
+};
+
+struct catalog;
+
+struct catalog *catalog_get(duc *duc);
+void catalog_free(struct catalog *c);
+duc_errno catalog_put(duc *duc, const struct duc_index_report *report);
+
+#endif
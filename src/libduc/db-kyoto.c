@@ -55,22 +55,8 @@ struct db *db_open(const char *path_db, int flags, duc_errno *e)
 		goto err2;
 	}
 
-	size_t vall;
-	char *version = db_get(db, "duc_db_version", 14, &vall);
-	if(version) {
-		if(strcmp(version, DUC_DB_VERSION) != 0) {
-			*e = DUC_E_DB_VERSION_MISMATCH;
-			goto err3;
-		}
-		free(version);
-	} else {
-		db_put(db, "duc_db_version", 14, DUC_DB_VERSION, strlen(DUC_DB_VERSION));
-	}
-
 	return db;
 
-err3:
-	kcdbclose(db->kdb);
 err2:
 	kcdbdel(db->kdb);
 err1:
@@ -94,6 +80,24 @@ duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val
 }
 
 
+duc_errno db_put_batch(struct db *db, const struct db_record *list, size_t count)
+{
+	size_t i;
+
+	if(!kcdbbegintran(db->kdb, 0)) return DUC_E_UNKNOWN;
+
+	for(i=0; i<count; i++) {
+		if(!kcdbset(db->kdb, list[i].key, list[i].key_len, list[i].val, list[i].val_len)) {
+			kcdbendtran(db->kdb, 0);
+			return DUC_E_UNKNOWN;
+		}
+	}
+
+	int r = kcdbendtran(db->kdb, 1);
+	return (r==1) ? DUC_OK : DUC_E_UNKNOWN;
+}
+
+
 void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 {
 	size_t vall;
@@ -102,6 +106,24 @@ void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 	return val;
 }
 
+
+/*
+ * No zero-copy access, views are emulated with a copy
+ */
+
+const void *db_get_view(struct db *db, const void *key, size_t key_len, struct db_view *view)
+{
+	view->data = db_get(db, key, key_len, &view->len);
+	view->priv = NULL;
+	return view->data;
+}
+
+
+void db_release_view(struct db *db, struct db_view *view)
+{
+	free((void *)view->data);
+}
+
 #endif
 
 /*
@@ -61,6 +61,26 @@ duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val
 }
 
 
+duc_errno db_put_batch(struct db *db, const struct db_record *list, size_t count)
+{
+	char *err = NULL;
+	size_t i;
+
+	leveldb_writebatch_t *batch = leveldb_writebatch_create();
+	for(i=0; i<count; i++) {
+		leveldb_writebatch_put(batch, list[i].key, list[i].key_len, list[i].val, list[i].val_len);
+	}
+	leveldb_write(db->db, db->woptions, batch, &err);
+	leveldb_writebatch_destroy(batch);
+
+	if(err) {
+		leveldb_free(err);
+		return DUC_E_UNKNOWN;
+	}
+	return DUC_OK;
+}
+
+
 duc_errno db_putcat(struct db *db, const void *key, size_t key_len, const void *val, size_t val_len)
 {
 	void *t;
@@ -87,6 +107,24 @@ void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 	return val;
 }
 
+
+/*
+ * No zero-copy access, views are emulated with a copy
+ */
+
+const void *db_get_view(struct db *db, const void *key, size_t key_len, struct db_view *view)
+{
+	view->data = db_get(db, key, key_len, &view->len);
+	view->priv = NULL;
+	return view->data;
+}
+
+
+void db_release_view(struct db *db, struct db_view *view)
+{
+	free((void *)view->data);
+}
+
 #endif
 
 /*
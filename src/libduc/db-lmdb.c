@@ -20,9 +20,71 @@ struct db {
 	MDB_env *env;
 	MDB_dbi dbi;
 	MDB_txn *txn;
+	int readonly;
+	size_t uncommitted;         /* Bytes written since the last commit */
+	size_t key_max;             /* Longer keys are stored by hash */
 };
 
 
+/*
+ * LMDB limits keys to mdb_env_get_maxkeysize(), 511 bytes by default, which
+ * deep paths in the path index or a long indexed path can exceed. Such keys
+ * are stored under a hash, with the full key in front of the value so a
+ * lookup can tell it apart from another key with the same hash.
+ */
+
+#define LONG_KEY_LEN 18
+
+static void long_key(const void *key, size_t key_len, uint8_t *out)
+{
+	const uint8_t *p = key;
+	uint64_t h1 = 0xcbf29ce484222325ULL;
+	uint64_t h2 = 0x84222325cbf29ce4ULL;
+	size_t i;
+
+	for(i=0; i<key_len; i++) {
+		h1 = (h1 ^ p[i]) * 0x100000001b3ULL;
+		h2 = (h2 ^ p[key_len - i - 1]) * 0x100000001b3ULL;
+	}
+
+	out[0] = 0xff;
+	out[1] = 'K';
+	memcpy(out + 2, &h1, 8);
+	memcpy(out + 10, &h2, 8);
+}
+
+
+/*
+ * Look up a key, returning the value in d. For long keys the stored key is
+ * checked and skipped.
+ */
+
+static int lmdb_get(struct db *db, const void *key, size_t key_len, MDB_val *d)
+{
+	uint8_t hkey[LONG_KEY_LEN];
+	MDB_val k;
+	int rc;
+
+	k.mv_size = key_len;
+	k.mv_data = (void *)key;
+
+	if(key_len > db->key_max) {
+		long_key(key, key_len, hkey);
+		k.mv_size = sizeof hkey;
+		k.mv_data = hkey;
+	}
+
+	rc = mdb_get(db->txn, db->dbi, &k, d);
+	if(rc != MDB_SUCCESS || key_len <= db->key_max) return rc;
+
+	if(d->mv_size < key_len || memcmp(d->mv_data, key, key_len) != 0) return MDB_NOTFOUND;
+	d->mv_data = (uint8_t *)d->mv_data + key_len;
+	d->mv_size -= key_len;
+
+	return MDB_SUCCESS;
+}
+
+
 struct db *db_open(const char *path_db, int flags, duc_errno *e)
 {
 	struct db *db;
@@ -43,7 +105,7 @@ struct db *db_open(const char *path_db, int flags, duc_errno *e)
 	size_t map_size = 1024u * 1024u * 1024u;
 	if(sizeof(size_t) == 8) map_size *= 256u;
 
-	db = duc_malloc(sizeof *db);
+	db = duc_malloc0(sizeof *db);
 
 	int rc;
 
@@ -56,12 +118,16 @@ struct db *db_open(const char *path_db, int flags, duc_errno *e)
 	rc = mdb_env_open(db->env, path_db, env_flags, 0664);
 	if(rc != MDB_SUCCESS) goto out;
 
+	db->readonly = !(flags & DUC_OPEN_RW);
+
 	rc = mdb_txn_begin(db->env, NULL, txn_flags, &db->txn);
 	if(rc != MDB_SUCCESS) goto out;
 
 	rc = mdb_open(db->txn, NULL, open_flags, &db->dbi);
 	if(rc != MDB_SUCCESS) goto out;
 
+	db->key_max = mdb_env_get_maxkeysize(db->env);
+
 	return db;
 out:
 	fprintf(stderr, "%s\n", mdb_strerror(rc));
@@ -82,6 +148,8 @@ void db_close(struct db *db)
 duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val, size_t val_len)
 {
 	MDB_val k, d;
+	uint8_t hkey[LONG_KEY_LEN];
+	void *tmp = NULL;
 	int rc;
 
 	k.mv_size = key_len;
@@ -89,25 +157,67 @@ duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val
 	d.mv_size = val_len;
 	d.mv_data = (void *)val;
 
+	if(key_len > db->key_max) {
+		long_key(key, key_len, hkey);
+		k.mv_size = sizeof hkey;
+		k.mv_data = hkey;
+		tmp = duc_malloc(key_len + val_len);
+		memcpy(tmp, key, key_len);
+		memcpy((uint8_t *)tmp + key_len, val, val_len);
+		d.mv_size = key_len + val_len;
+		d.mv_data = tmp;
+	}
+
 	rc = mdb_put(db->txn, db->dbi, &k, &d, 0);
+	duc_free(tmp);
 	if(rc != MDB_SUCCESS) {
 		fprintf(stderr, "%s\n", mdb_strerror(rc));
 		exit(1);
 	}
 
+	db->uncommitted += key_len + val_len;
+
 	return DUC_OK;
 }
 
 
-void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
+/*
+ * Records are written in the running transaction, which is committed and
+ * renewed every DB_COMMIT_BYTES so dirty pages do not pile up for the
+ * whole index run.
+ */
+
+duc_errno db_put_batch(struct db *db, const struct db_record *list, size_t count)
 {
-	MDB_val k, d;
+	size_t i;
 	int rc;
 
-	k.mv_size = key_len;
-	k.mv_data = (void *)key;
+	for(i=0; i<count; i++) {
+		db_put(db, list[i].key, list[i].key_len, list[i].val, list[i].val_len);
+	}
 
-	rc = mdb_get(db->txn, db->dbi, &k, &d);
+	if(db->uncommitted >= DB_COMMIT_BYTES) {
+		rc = mdb_txn_commit(db->txn);
+		if(rc == MDB_SUCCESS) {
+			rc = mdb_txn_begin(db->env, NULL, 0, &db->txn);
+		}
+		if(rc != MDB_SUCCESS) {
+			fprintf(stderr, "%s\n", mdb_strerror(rc));
+			exit(1);
+		}
+		db->uncommitted = 0;
+	}
+
+	return DUC_OK;
+}
+
+
+void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
+{
+	MDB_val d;
+	int rc;
+
+	rc = lmdb_get(db, key, key_len, &d);
 
 	if(rc == MDB_SUCCESS) {
 		*val_len = d.mv_size;
@@ -120,6 +230,41 @@ void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 	}
 }
 
+
+/*
+ * Values point into the memory map and stay valid for the lifetime of the
+ * read-only transaction. When writing they can move with the next put,
+ * so a copy is made.
+ */
+
+const void *db_get_view(struct db *db, const void *key, size_t key_len, struct db_view *view)
+{
+	MDB_val d;
+
+	view->priv = NULL;
+
+	if(!db->readonly) {
+		view->data = view->priv = db_get(db, key, key_len, &view->len);
+		return view->data;
+	}
+
+	if(lmdb_get(db, key, key_len, &d) != MDB_SUCCESS) {
+		view->data = NULL;
+		view->len = 0;
+		return NULL;
+	}
+
+	view->data = d.mv_data;
+	view->len = d.mv_size;
+	return view->data;
+}
+
+
+void db_release_view(struct db *db, struct db_view *view)
+{
+	free(view->priv);
+}
+
 #endif
 
 /*
@@ -16,14 +16,53 @@
 
 struct db {
 	sqlite3 *s;
+	sqlite3_stmt *put;          /* Prepared on first use and reused */
+	size_t uncommitted;         /* Bytes written since the last commit */
+	int key_blob;               /* Keys are stored as blobs, not text */
 };
 
+
+/*
+ * Keys are binary, so new databases declare the key column as a blob and
+ * keys are bound as blobs. Databases created before that have an untyped
+ * key column holding text keys, which must be bound as text to match.
+ */
+
+static int key_is_blob(struct db *db)
+{
+	sqlite3_stmt *pStmt;
+	int blob = 0;
+
+	if(sqlite3_prepare_v2(db->s, "pragma table_info(blobs)", -1, &pStmt, 0) != SQLITE_OK) return 0;
+
+	while(sqlite3_step(pStmt) == SQLITE_ROW) {
+		const char *name = (const char *)sqlite3_column_text(pStmt, 1);
+		const char *type = (const char *)sqlite3_column_text(pStmt, 2);
+		if(name && type && strcmp(name, "key") == 0) {
+			blob = (sqlite3_stricmp(type, "blob") == 0);
+		}
+	}
+	sqlite3_finalize(pStmt);
+
+	return blob;
+}
+
+
+static void bind_key(struct db *db, sqlite3_stmt *pStmt, const void *key, size_t key_len)
+{
+	if(db->key_blob) {
+		sqlite3_bind_blob(pStmt, 1, key, key_len, SQLITE_STATIC);
+	} else {
+		sqlite3_bind_text(pStmt, 1, key, key_len, SQLITE_STATIC);
+	}
+}
+
 struct db *db_open(const char *path_db, int flags, duc_errno *e)
 {
 	struct db *db;
 	int sflags = 0;
 
-	db = duc_malloc(sizeof *db);
+	db = duc_malloc0(sizeof *db);
 
 	if(flags & DUC_OPEN_RW)
 		sflags |= SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
@@ -39,11 +78,13 @@ struct db *db_open(const char *path_db, int flags, duc_errno *e)
 	r = sqlite3_exec(db->s, "select bogus from bogus", 0, 0, 0);
 	if(r != 1) goto err1;
 
-	char *q = "create table blobs(key unique primary key, value)";
+	char *q = "create table blobs(key blob unique primary key, value)";
 	sqlite3_exec(db->s, q, 0, 0, 0);
 	
 	q = "create index keys on blobs(key)";
 	sqlite3_exec(db->s, q, 0, 0, 0);
+
+	db->key_blob = key_is_blob(db);
 	
 	sqlite3_exec(db->s, "begin", 0, 0, 0);
 
@@ -58,6 +99,7 @@ err1:
 
 void db_close(struct db *db)
 {
+	if(db->put) sqlite3_finalize(db->put);
 	sqlite3_exec(db->s, "commit", 0, 0, 0);
 	sqlite3_close(db->s);
 	free(db);
@@ -66,15 +108,48 @@ void db_close(struct db *db)
 
 duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val, size_t val_len)
 {
-	sqlite3_stmt *pStmt;
 	char *q = "insert or replace into blobs(key, value) values(?, ?)";
 
-	sqlite3_prepare(db->s, q, -1, &pStmt, 0);
-	sqlite3_bind_text(pStmt, 1, key, key_len, SQLITE_STATIC);
-	sqlite3_bind_blob(pStmt, 2, val, val_len, SQLITE_STATIC);
-	sqlite3_step(pStmt);
-	sqlite3_finalize(pStmt);
-	return DUC_OK;
+	if(db->put == NULL) {
+		int r = sqlite3_prepare_v2(db->s, q, -1, &db->put, 0);
+		if(r != SQLITE_OK) return DUC_E_UNKNOWN;
+	}
+
+	bind_key(db, db->put, key, key_len);
+	sqlite3_bind_blob(db->put, 2, val, val_len, SQLITE_STATIC);
+	int r = sqlite3_step(db->put);
+	sqlite3_reset(db->put);
+	sqlite3_clear_bindings(db->put);
+
+	db->uncommitted += key_len + val_len;
+
+	return (r == SQLITE_DONE) ? DUC_OK : DUC_E_UNKNOWN;
+}
+
+
+/*
+ * All records go through the same prepared statement. The transaction
+ * started at open is committed every DB_COMMIT_BYTES to keep the journal
+ * from growing with the whole index.
+ */
+
+duc_errno db_put_batch(struct db *db, const struct db_record *list, size_t count)
+{
+	duc_errno e = DUC_OK;
+	size_t i;
+
+	for(i=0; i<count; i++) {
+		duc_errno r = db_put(db, list[i].key, list[i].key_len, list[i].val, list[i].val_len);
+		if(r != DUC_OK) e = r;
+	}
+
+	if(db->uncommitted >= DB_COMMIT_BYTES) {
+		sqlite3_exec(db->s, "commit", 0, 0, 0);
+		sqlite3_exec(db->s, "begin", 0, 0, 0);
+		db->uncommitted = 0;
+	}
+
+	return e;
 }
 
 
@@ -85,7 +160,7 @@ void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 	char *val = NULL;
 
 	sqlite3_prepare(db->s, q, -1, &pStmt, 0);
-	sqlite3_bind_text(pStmt, 1, key, key_len, SQLITE_STATIC);
+	bind_key(db, pStmt, key, key_len);
 
 	int r = sqlite3_step(pStmt);
 	if(r == SQLITE_ROW) {
@@ -98,6 +173,44 @@ void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 	return val;
 }
 
+
+/*
+ * The view points at the blob of the result row, the statement is kept
+ * open until the view is released.
+ */
+
+const void *db_get_view(struct db *db, const void *key, size_t key_len, struct db_view *view)
+{
+	sqlite3_stmt *pStmt;
+	char *q = "select value from blobs where key = ?";
+
+	view->data = NULL;
+	view->len = 0;
+	view->priv = NULL;
+
+	sqlite3_prepare_v2(db->s, q, -1, &pStmt, 0);
+	bind_key(db, pStmt, key, key_len);
+
+	int r = sqlite3_step(pStmt);
+	if(r != SQLITE_ROW) {
+		sqlite3_finalize(pStmt);
+		return NULL;
+	}
+
+	view->data = sqlite3_column_blob(pStmt, 0);
+	view->len = sqlite3_column_bytes(pStmt, 0);
+	view->priv = pStmt;
+	if(view->data == NULL) view->data = "";
+
+	return view->data;
+}
+
+
+void db_release_view(struct db *db, struct db_view *view)
+{
+	if(view->priv) sqlite3_finalize(view->priv);
+}
+
 #endif
 
 /*
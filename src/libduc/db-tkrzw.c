@@ -86,22 +86,8 @@ struct db *db_open(const char *path_db, int flags, duc_errno *e)
 	    goto err1;
 	}
 
-	size_t vall;
-	char *version = db_get(db, "duc_db_version", 14, &vall);
-	if (version) {
-		if(strcmp(version, DUC_DB_VERSION) != 0) {
-			*e = DUC_E_DB_VERSION_MISMATCH;
-			goto err2;
-		}
-		free(version);
-	} else {
-		db_put(db, "duc_db_version", 14, DUC_DB_VERSION, strlen(DUC_DB_VERSION));
-	}
-
 	return db;
 
-err2:
-	tkrzw_dbm_close(db->hdb);
 err1:
 	free(db);
 	return NULL;
@@ -122,6 +108,25 @@ duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val
 }
 
 
+duc_errno db_put_batch(struct db *db, const struct db_record *list, size_t count)
+{
+	TkrzwKeyValuePair *pairs = duc_malloc(count * sizeof(*pairs));
+	size_t i;
+
+	for(i=0; i<count; i++) {
+		pairs[i].key_ptr = list[i].key;
+		pairs[i].key_size = list[i].key_len;
+		pairs[i].value_ptr = list[i].val;
+		pairs[i].value_size = list[i].val_len;
+	}
+
+	int r = tkrzw_dbm_set_multi(db->hdb, pairs, count, 1);
+	duc_free(pairs);
+
+	return (r==1) ? DUC_OK : DUC_E_UNKNOWN;
+}
+
+
 void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 {
 	int vall;
@@ -130,6 +135,24 @@ void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 	return val;
 }
 
+
+/*
+ * No zero-copy access, views are emulated with a copy
+ */
+
+const void *db_get_view(struct db *db, const void *key, size_t key_len, struct db_view *view)
+{
+	view->data = db_get(db, key, key_len, &view->len);
+	view->priv = NULL;
+	return view->data;
+}
+
+
+void db_release_view(struct db *db, struct db_view *view)
+{
+	free((void *)view->data);
+}
+
 #endif
 
 /*
@@ -73,22 +73,8 @@ struct db *db_open(const char *path_db, int flags, duc_errno *e)
 		goto err2;
 	}
 
-	size_t vall;
-	char *version = db_get(db, "duc_db_version", 14, &vall);
-	if(version) {
-		if(strcmp(version, DUC_DB_VERSION) != 0) {
-			*e = DUC_E_DB_VERSION_MISMATCH;
-			goto err3;
-		}
-		free(version);
-	} else {
-		db_put(db, "duc_db_version", 14, DUC_DB_VERSION, strlen(DUC_DB_VERSION));
-	}
-
 	return db;
 
-err3:
-	tcbdbclose(db->hdb);
 err2:
 	tcbdbdel(db->hdb);
 err1:
@@ -112,6 +98,25 @@ duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val
 }
 
 
+duc_errno db_put_batch(struct db *db, const struct db_record *list, size_t count)
+{
+	size_t i;
+
+	if(!tcbdbtranbegin(db->hdb)) return tcdb_to_errno(db->hdb);
+
+	for(i=0; i<count; i++) {
+		if(!tcbdbput(db->hdb, list[i].key, list[i].key_len, list[i].val, list[i].val_len)) {
+			duc_errno e = tcdb_to_errno(db->hdb);
+			tcbdbtranabort(db->hdb);
+			return e;
+		}
+	}
+
+	int r = tcbdbtrancommit(db->hdb);
+	return (r==1) ? DUC_OK : DUC_E_UNKNOWN;
+}
+
+
 void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 {
 	int vall;
@@ -120,6 +125,24 @@ void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len)
 	return val;
 }
 
+
+/*
+ * No zero-copy access, views are emulated with a copy
+ */
+
+const void *db_get_view(struct db *db, const void *key, size_t key_len, struct db_view *view)
+{
+	view->data = db_get(db, key, key_len, &view->len);
+	view->priv = NULL;
+	return view->data;
+}
+
+
+void db_release_view(struct db *db, struct db_view *view)
+{
+	free((void *)view->data);
+}
+
 #endif
 
 /*
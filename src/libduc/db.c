@@ -9,88 +9,121 @@
 #include "db.h"
 #include "buffer.h"
 #include "private.h"
+#include "catalog.h"
 
 #define MAGIC_LEN 64
 
 
-
-/* 
- * Store report. Add the report index to the 'duc_index_reports' key if not
- * previously indexed 
+/*
+ * Check the version stored in the database, writing it to new databases.
+ * Databases of an older version that can still be decoded are opened
+ * read-only. Version 17 is recognized by the version key or, for backends
+ * that did not store it, by the presence of an index report list.
  */
 
-duc_errno db_write_report(duc *duc, const struct duc_index_report *report)
+duc_errno db_check_version(duc *duc, int flags)
 {
-	size_t tmpl;
-	char *tmp = db_get(duc->db, report->path, strlen(report->path), &tmpl);
-
-	//printf("writing report, ->topn_cnt = %d, ->topn_cnt_max = %d\n",report->topn_cnt, report->topn_cnt_max);
-	if(tmp == NULL) {
-		char *tmp = db_get(duc->db, "duc_index_reports", 17, &tmpl);
-		if(tmp) {
-			tmp = duc_realloc(tmp, tmpl + sizeof(report->path));
-			memcpy(tmp + tmpl, report->path, sizeof(report->path));
-			db_put(duc->db, "duc_index_reports", 17, tmp, tmpl + sizeof(report->path));
-		} else {
-			db_put(duc->db, "duc_index_reports", 17, report->path, sizeof(report->path));
-		}
-		
-		/* write histogram */
-		tmp = db_get(duc->db, "duc_index_histograms", 20, &tmpl);
-		if (tmp) {
-			tmp = duc_realloc(tmp, tmpl + sizeof(report->histogram));
-			memcpy(tmp + tmpl, report->histogram, sizeof(report->histogram));
-			db_put(duc->db, "duc_index_histograms", 20, tmp, 
-			       tmpl + sizeof(report->histogram));
-		} else {
-			db_put(duc->db, "duc_index_histograms", 20, report->histogram, 
-			       sizeof(report->histogram));
+	size_t vall;
+	char *version = db_get(duc->db, "duc_db_version", 14, &vall);
+	char buf[16];
+
+	duc->db_version = atoi(DUC_DB_VERSION);
+
+	if(version == NULL) {
+		char *reports = db_get(duc->db, "duc_index_reports", 17, &vall);
+		if(reports == NULL) {
+			if(flags & DUC_OPEN_RW) {
+				db_put(duc->db, "duc_db_version", 14, DUC_DB_VERSION, strlen(DUC_DB_VERSION));
+			}
+			return DUC_OK;
 		}
+		free(reports);
+		duc->db_version = 17;
+	} else {
+		snprintf(buf, sizeof(buf), "%.*s", (int)vall, version);
+		duc->db_version = atoi(buf);
+		free(version);
+	}
 
-		/* write topn array, FIXME to really work... */
-		char str[] = "duc_index_topn_info";
-		int str_len = sizeof(str);
-		tmp = db_get(duc->db, str, str_len , &tmpl);
-		if (tmp) {
-			tmp = duc_realloc(tmp, tmpl + sizeof(report->topn_array));
-			memcpy(tmp + tmpl, report->topn_array, sizeof(report->topn_array));
-			db_put(duc->db, str, str_len, tmp, 
-			       tmpl + sizeof(report->topn_array));
-		} else {
-			db_put(duc->db, str, str_len, report->topn_array, 
-			       sizeof(report->topn_array));
-		}
+	if(duc->db_version == atoi(DUC_DB_VERSION)) return DUC_OK;
+	if(duc->db_version >= DUC_DB_VERSION_MIN && !(flags & DUC_OPEN_RW)) return DUC_OK;
 
-	} else {
-		free(tmp);
+	return DUC_E_DB_VERSION_MISMATCH;
+}
+
+
+/*
+ * Build the key for a directory record in key, which must hold DB_KEY_MAX
+ * bytes. Returns the key length.
+ */
+
+size_t db_key_devino(duc *duc, enum db_key_type type, const struct duc_devino *devino, char *key)
+{
+	uint64_t dev = devino->dev;
+	uint64_t ino = devino->ino;
+	int i;
+
+	if(duc->db_version < DB_VERSION_BINARY_KEYS) {
+		return snprintf(key, DB_KEY_MAX, "%jx/%jx%s", (uintmax_t)dev, (uintmax_t)ino,
+				type == DB_KEY_HISTOGRAM ? "/h" : "");
 	}
 
+	key[0] = type;
+	for(i=0; i<8; i++) {
+		key[1 + i] = dev >> (56 - i * 8);
+		key[9 + i] = ino >> (56 - i * 8);
+	}
+
+	return 17;
+}
+
+
+/*
+ * Key of the path index entry of the first len bytes of path, key must have
+ * room for len + 1 bytes
+ */
+
+size_t db_key_path(const char *path, size_t len, char *key)
+{
+	key[0] = DB_KEY_PATH;
+	memcpy(key + 1, path, len);
+	return len + 1;
+}
+
+
+
+/*
+ * Store report and add it to the report catalog
+ */
+
+duc_errno db_write_report(duc *duc, const struct duc_index_report *report)
+{
 	struct buffer *b = buffer_new(NULL, 0);
 
 	buffer_put_index_report(b, report);
 	db_put(duc->db, report->path, strlen(report->path), b->data, b->len);
 	buffer_free(b);
 
-	return 0;
+	return catalog_put(duc, report);
 }
 
 
-struct duc_index_report *db_read_report(duc *duc, const char *path)
+struct duc_report *db_read_report(duc *duc, const char *path)
 {
-	struct duc_index_report *report;
-	size_t vall;
+	struct duc_report *report;
+	struct db_view view;
 
-	char *val = db_get(duc->db, path, strlen(path), &vall);
-	if(val == NULL) {
+	if(db_get_view(duc->db, path, strlen(path), &view) == NULL) {
 		duc->err = DUC_E_PATH_NOT_FOUND;
 		return NULL;
 	}
 
-	struct buffer *b = buffer_new(val, vall);
+	struct buffer *b = buffer_new_view(view.data, view.len);
 
 	report = duc_malloc(sizeof *report);
-	buffer_get_index_report(b, report);
+	buffer_get_report(b, report);
 	buffer_free(b);
+	db_release_view(duc->db, &view);
 
 	return report;
 }
@@ -4,16 +4,60 @@
 
 #include "duc.h"
 
+/* Backends doing periodic commits write out their transaction after this
+ * many bytes of batched records */
+#define DB_COMMIT_BYTES (64 * 1024 * 1024)
+
+/* Database versions introducing a format change that readers handle */
+#define DB_VERSION_BINARY_KEYS 18
+#define DB_VERSION_DIR_COLUMNS 19
+
+/* Directory records are stored under a type byte followed by the big
+ * endian dev and inode, so records of one device sort together. Path index
+ * entries use the type byte followed by the path. */
+#define DB_KEY_MAX 48
+
+enum db_key_type {
+	DB_KEY_DIR = 0x01,
+	DB_KEY_HISTOGRAM = 0x02,
+	DB_KEY_PATH = 0x03,
+};
+
 struct db;
 
+struct db_record {
+	const void *key;
+	size_t key_len;
+	const void *val;
+	size_t val_len;
+};
+
+/*
+ * A value borrowed from the database by db_get_view(). The data is valid
+ * until it is handed back with db_release_view().
+ */
+
+struct db_view {
+	const void *data;
+	size_t len;
+	void *priv;
+};
+
 struct db *db_open(const char *path_db, int flags, duc_errno *e);
 void db_close(struct db *db);
 duc_errno db_put(struct db *db, const void *key, size_t key_len, const void *val, size_t val_len);
+duc_errno db_put_batch(struct db *db, const struct db_record *list, size_t count);
 void *db_get(struct db *db, const void *key, size_t key_len, size_t *val_len);
+const void *db_get_view(struct db *db, const void *key, size_t key_len, struct db_view *view);
+void db_release_view(struct db *db, struct db_view *view);
+
 
+duc_errno db_check_version(duc *duc, int flags);
+size_t db_key_devino(duc *duc, enum db_key_type type, const struct duc_devino *devino, char *key);
+size_t db_key_path(const char *path, size_t len, char *key);
 
 duc_errno db_write_report(duc *duc, const struct duc_index_report *rep);
-struct duc_index_report *db_read_report(duc *duc, const char *path);
+struct duc_report *db_read_report(duc *duc, const char *path);
 
 #endif
 
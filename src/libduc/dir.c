@@ -12,6 +12,8 @@
 #include "db.h"
 #include "buffer.h"
 #include "private.h"
+#include "dircache.h"
+#include "catalog.h"
 
 
 struct duc_dir {
@@ -20,25 +22,54 @@ struct duc_dir {
 	struct duc_devino devino_parent;
 	time_t mtime;
 	char *path;
-	struct duc_dirent *ent_list;
+	struct duc_dirent *ent_list;        /* Sorted by name */
+	struct duc_dirent **order;          /* Entries sorted by size */
+	size_t order_len;                   /* Number of valid leading entries in order */
+	uint64_t *rank;             /* Position of each entry in the default order */
+	struct dircache_ent *cached;        /* Holds ent_list and rank */
+	struct buffer *record;      /* Entries not decoded yet */
+	struct db_view view;
+	struct dir_header header;
 	struct duc_size size;
 	size_t ent_cur;
 	size_t ent_count;
-	size_t ent_pool;
 	duc_size_type size_type;
-	duc_sort sort;
 };
 
 
+static int fn_comp_name(const void *a, const void *b)
+{
+	const struct duc_dirent *ea = a;
+	const struct duc_dirent *eb = b;
+	return strcmp(ea->name, eb->name);
+}
+
+
+/*
+ * Take the decoded entries from a cache entry, which holds on to them until
+ * the dir is closed
+ */
+
+static void dir_attach(duc_dir *dir, struct dircache_ent *ce)
+{
+	dir->cached = ce;
+	dir->ent_list = ce->ent_list;
+	dir->rank = ce->rank;
+}
+
+
 struct duc_dir *duc_dir_new(struct duc *duc, const struct duc_devino *devino)
 {
-	size_t vall;
-	char key[32];
-	size_t keyl = snprintf(key, sizeof(key), "%jx/%jx", (uintmax_t)devino->dev, (uintmax_t)devino->ino);
-	char *val = db_get(duc->db, key, keyl, &vall);
-	if(val == NULL) {
-		duc->err = DUC_E_PATH_NOT_FOUND;
-		return NULL;
+	struct dircache_ent *ce = dircache_get(duc->dircache, devino);
+	struct db_view view;
+
+	if(ce == NULL) {
+		char key[DB_KEY_MAX];
+		size_t keyl = db_key_devino(duc, DB_KEY_DIR, devino, key);
+		if(db_get_view(duc->db, key, keyl, &view) == NULL) {
+			duc->err = DUC_E_PATH_NOT_FOUND;
+			return NULL;
+		}
 	}
 
 	struct duc_dir *dir = duc_malloc0(sizeof(struct duc_dir));
@@ -47,35 +78,85 @@ struct duc_dir *duc_dir_new(struct duc *duc, const struct duc_devino *devino)
 	dir->devino.dev = devino->dev;
 	dir->devino.ino = devino->ino;
 	dir->path = NULL;
-	dir->ent_pool = 32768;
-	dir->ent_list = duc_malloc(dir->ent_pool);
 	dir->size_type = -1;
 
-	struct buffer *b = buffer_new(val, vall);
+	struct dir_header *h = &dir->header;
+
+	if(ce) {
+		*h = ce->header;
+		dir_attach(dir, ce);
+	} else {
+		struct buffer *b = buffer_new_view(view.data, view.len);
+		buffer_get_dir(b, h, duc->db_version < DB_VERSION_DIR_COLUMNS);
 
-	/* Read dir header */
+		if(h->flags & DIR_FLAG_ROWS) {
 
-	buffer_get_dir(b, &dir->devino_parent, &dir->mtime);
+			/* Count and totals are only known after decoding all
+			 * rows, which are stored unsorted */
 
-	/* Read all dirents */
+			struct duc_dirent *ent_list = buffer_get_dirents(b, h, NULL);
+			qsort(ent_list, h->count, sizeof(struct duc_dirent), fn_comp_name);
+			buffer_free(b);
+			db_release_view(duc->db, &view);
+			dir_attach(dir, dircache_add(duc->dircache, devino, h, ent_list, NULL));
+		} else {
 
-	while(b->ptr < b->len) {
+			/* The header holds all we need for the totals, decoding
+			 * the entries is left to the first call needing them */
 
-		if((dir->ent_count+1) * sizeof(struct duc_dirent) > dir->ent_pool) {
-			dir->ent_pool *= 2;
-			dir->ent_list = duc_realloc(dir->ent_list, dir->ent_pool);
+			dir->record = b;
+			dir->view = view;
 		}
+	}
 
-		struct duc_dirent *ent = &dir->ent_list[dir->ent_count];
-		buffer_get_dirent(b, ent);
+	dir->devino_parent = h->devino_parent;
+	dir->mtime = h->mtime;
+	dir->ent_count = h->count;
+	dir->size = h->size;
 
-		duc_size_accum(&dir->size, &ent->size);
-		dir->ent_count ++;
+	return dir;
+}
+
+
+static void dir_release_record(duc_dir *dir)
+{
+	if(dir->record) {
+		buffer_free(dir->record);
+		db_release_view(dir->duc->db, &dir->view);
+		dir->record = NULL;
 	}
+}
 
-	buffer_free(b);
 
-	return dir;
+/*
+ * Decode the entries if not done yet, they come out sorted by name
+ */
+
+static void dir_load(duc_dir *dir)
+{
+	if(dir->record) {
+		uint64_t *rank;
+		struct duc_dirent *ent_list = buffer_get_dirents(dir->record, &dir->header, &rank);
+		dir_release_record(dir);
+		dir_attach(dir, dircache_add(dir->duc->dircache, &dir->devino, &dir->header, ent_list, rank));
+	}
+}
+
+
+/*
+ * Find an entry by name. ent_list is sorted by name, so this is a binary
+ * search
+ */
+
+static struct duc_dirent *dir_find(duc_dir *dir, const char *name)
+{
+	struct duc_dirent key;
+
+	dir_load(dir);
+	if(dir->ent_count == 0) return NULL;
+
+	key.name = (char *)name;
+	return bsearch(&key, dir->ent_list, dir->ent_count, sizeof(struct duc_dirent), fn_comp_name);
 }
 
 
@@ -91,6 +172,33 @@ size_t duc_dir_get_count(duc_dir *dir)
 }
 
 
+/*
+ * Get the file size histogram of the whole subtree below this directory,
+ * as stored when indexing with DUC_INDEX_DIR_HISTOGRAM. Bucket i counts the
+ * files of 2^i up to 2^(i+1)-1 bytes. Returns the number of buckets
+ * stored, or -1 if the directory has no histogram.
+ */
+
+int duc_dir_get_histogram(duc_dir *dir, size_t *histogram, int buckets)
+{
+	struct duc_devino *devino = &dir->devino;
+	struct db_view view;
+	char key[DB_KEY_MAX];
+	size_t keyl = db_key_devino(dir->duc, DB_KEY_HISTOGRAM, devino, key);
+	if(db_get_view(dir->duc->db, key, keyl, &view) == NULL) {
+		dir->duc->err = DUC_E_PATH_NOT_FOUND;
+		return -1;
+	}
+
+	struct buffer *b = buffer_new_view(view.data, view.len);
+	int n = buffer_get_histogram(b, histogram, buckets);
+	buffer_free(b);
+	db_release_view(dir->duc->db, &view);
+
+	return n;
+}
+
+
 char *duc_dir_get_path(duc_dir *dir)
 {
 	return strdup(dir->path);
@@ -129,14 +237,8 @@ duc_dir *duc_dir_openat(duc_dir *dir, const char *name)
 
 		/* Find given name in dir */
 
-		size_t i;
-		struct duc_dirent *e = dir->ent_list;
-		for(i=0; i<dir->ent_count; i++) {
-			if(strcmp(e->name, name) == 0) {
-				return duc_dir_openent(dir, e);
-			}
-			e++;
-		}
+		struct duc_dirent *e = dir_find(dir, name);
+		if(e) return duc_dir_openent(dir, e);
 	}
 
 	return NULL;
@@ -145,59 +247,133 @@ duc_dir *duc_dir_openat(duc_dir *dir, const char *name)
 
 struct duc_dirent *duc_dir_find_child(duc_dir *dir, const char *name)
 {
-	size_t i;
-	struct duc_dirent *ent = dir->ent_list;
+	struct duc_dirent *ent = dir_find(dir, name);
 
-	for(i=0; i<dir->ent_count; i++) {
-		if(strcmp(name, ent->name) == 0) {
-			return ent;
-		}
-		ent++;
+	if(ent == NULL) {
+		dir->duc->err = DUC_E_PATH_NOT_FOUND;
 	}
-	
-	dir->duc->err = DUC_E_PATH_NOT_FOUND;
-	return NULL;
+
+	return ent;
 }
 
 
-duc_dir *duc_dir_open(struct duc *duc, const char *path)
+/*
+ * Length of the parent of the first len bytes of a canonical path, 0 if
+ * there is none
+ */
+
+static size_t path_parent(const char *path, size_t len)
 {
-	/* Canonicalized path */
+	if(len <= 1) return 0;
+	while(len > 1 && path[len-1] != '/') len --;
+	return len > 1 ? len - 1 : len;
+}
 
-	char *path_canon = duc_canonicalize_path(path);
-	if(!path_canon) {
-		duc->err = DUC_E_PATH_NOT_FOUND;
-		return NULL;
+
+static int path_index_get(duc *duc, const char *path, size_t len, struct path_entry *pe)
+{
+	char key[DUC_PATH_MAX + 1];
+	struct db_view view;
+
+	if(len > DUC_PATH_MAX) return 0;
+
+	size_t keyl = db_key_path(path, len, key);
+	if(db_get_view(duc->db, key, keyl, &view) == NULL) return 0;
+
+	struct buffer *b = buffer_new_view(view.data, view.len);
+	buffer_get_path_entry(b, pe);
+	buffer_free(b);
+	db_release_view(duc->db, &view);
+
+	return 1;
+}
+
+
+/*
+ * Find the deepest directory of path in the path index. Entries are only
+ * used when the root they were indexed from was last indexed by the same
+ * run, otherwise the directory might have been moved or removed since.
+ * Returns the length of the path found, or 0.
+ */
+
+static size_t path_index_find(duc *duc, const char *path, struct duc_devino *devino)
+{
+	struct path_entry pe, root;
+	size_t len;
+
+	if(duc->db_version < DB_VERSION_BINARY_KEYS) return 0;
+
+	for(len=strlen(path); len>0; len=path_parent(path, len)) {
+		if(!path_index_get(duc, path, len, &pe)) continue;
+		if(pe.root_len > len) continue;
+		if(pe.root_len < len) {
+			if(!path_index_get(duc, path, pe.root_len, &root)) continue;
+			if(root.root_len != pe.root_len || root.stamp != pe.stamp) continue;
+		}
+		*devino = pe.devino;
+		return len;
 	}
 
-	/* Find top path in database */
+	return 0;
+}
 
-	char *path_try = duc_strdup(path_canon);
-	int l = strlen(path_try);
-	struct duc_devino devino = { 0, 0 };
-	while(l > 0) {
-		path_try[l] = '\0';
-		struct duc_index_report *report;
-		report = db_read_report(duc, path_try);
+
+/*
+ * Find the indexed root holding path by trying the path and its parents.
+ * Returns the length of the root path, or 0.
+ */
+
+static size_t report_find(duc *duc, const char *path, struct duc_devino *devino)
+{
+	char *path_try = duc_strdup(path);
+	size_t len;
+
+	for(len=strlen(path_try); len>0; len=path_parent(path_try, len)) {
+		path_try[len] = '\0';
+		struct duc_report *report = db_read_report(duc, path_try);
 		if(report) {
-			devino = report->devino;
-			free(report);
+			*devino = report->info.devino;
+			duc_report_close(report);
 			break;
 		}
-		l--;
 	}
+
 	free(path_try);
+	return len;
+}
+
 
-	if(l == 0) {
-		duc_log(duc, DUC_LOG_FTL, "Path %s not found in database", path_canon);
+duc_dir *duc_dir_open(struct duc *duc, const char *path)
+{
+	/* Canonicalized path */
+
+	char *path_canon = duc_canonicalize_path(path);
+	if(!path_canon) {
 		duc->err = DUC_E_PATH_NOT_FOUND;
-		free(path_canon);
 		return NULL;
 	}
 
-	struct duc_dir *dir;
+	/* Find the deepest directory of the path in the path index, or else
+	 * the top path in the database */
+
+	struct duc_devino devino = { 0, 0 };
+	struct duc_dir *dir = NULL;
+	size_t l = path_index_find(duc, path_canon, &devino);
+
+	if(l > 0) {
+		dir = duc_dir_new(duc, &devino);
+	}
 
-	dir = duc_dir_new(duc, &devino);
+	if(dir == NULL) {
+		l = report_find(duc, path_canon, &devino);
+		if(l == 0) {
+			duc_log(duc, DUC_LOG_FTL, "Path %s not found in database", path_canon);
+			duc->err = DUC_E_PATH_NOT_FOUND;
+			free(path_canon);
+			return NULL;
+		}
+		dir = duc_dir_new(duc, &devino);
+	}
 
 	if(dir == NULL) {
 		duc->err = DUC_E_PATH_NOT_FOUND;
@@ -235,91 +411,256 @@ duc_dir *duc_dir_open(struct duc *duc, const char *path)
 }
 
 
-static int fn_comp_apparent(const void *a, const void *b)
+/*
+ * Order of the default listing, largest actual size first. Used by the
+ * indexer to store this order in the directory record.
+ */
+
+int duc_dirent_cmp_actual(const struct duc_dirent *ea, const struct duc_dirent *eb)
 {
-	const struct duc_dirent *ea = a;
-	const struct duc_dirent *eb = b;
 	const struct duc_size *sa = &ea->size;
 	const struct duc_size *sb = &eb->size;
-	if(sa->apparent < sb->apparent) return +1;
-	if(sa->apparent > sb->apparent) return -1;
 	if(sa->actual < sb->actual) return +1;
 	if(sa->actual > sb->actual) return -1;
+	if(sa->apparent < sb->apparent) return +1;
+	if(sa->apparent > sb->apparent) return -1;
 	return strcmp(ea->name, eb->name);
 }
 
 
-static int fn_comp_actual(const void *a, const void *b)
+/*
+ * Sorting by size works on a pair of 64 bit keys per entry, inverted to put
+ * the largest first. The entries are taken from ent_list, which is sorted by
+ * name, so comparing the entry pointers breaks ties the same way comparing
+ * the names would.
+ */
+
+struct sort_item {
+	uint64_t key[2];
+	struct duc_dirent *ent;
+};
+
+
+static void sort_item_set(struct sort_item *item, struct duc_dirent *ent, duc_size_type st)
 {
-	const struct duc_dirent *ea = a;
-	const struct duc_dirent *eb = b;
-	const struct duc_size *sa = &ea->size;
-	const struct duc_size *sb = &eb->size;
-	if(sa->actual < sb->actual) return +1;
-	if(sa->actual > sb->actual) return -1;
-	if(sa->apparent < sb->apparent) return +1;
-	if(sa->apparent > sb->apparent) return -1;
-	return strcmp(ea->name, eb->name);
+	const struct duc_size *s = &ent->size;
+
+	item->ent = ent;
+
+	switch(st) {
+		case DUC_SIZE_TYPE_APPARENT:
+			item->key[0] = ~(uint64_t)s->apparent;
+			item->key[1] = ~(uint64_t)s->actual;
+			break;
+		case DUC_SIZE_TYPE_ACTUAL:
+			item->key[0] = ~(uint64_t)s->actual;
+			item->key[1] = ~(uint64_t)s->apparent;
+			break;
+		default:
+			item->key[0] = ~(uint64_t)s->count;
+			item->key[1] = 0;
+			break;
+	}
 }
 
 
-static int fn_comp_count(const void *a, const void *b)
+static int sort_item_cmp(const void *a, const void *b)
 {
-	const struct duc_dirent *ea = a;
-	const struct duc_dirent *eb = b;
-	const struct duc_size *sa = &ea->size;
-	const struct duc_size *sb = &eb->size;
-	if(sa->count < sb->count) return +1;
-	if(sa->count > sb->count) return -1;
-	return strcmp(ea->name, eb->name);
+	const struct sort_item *ia = a;
+	const struct sort_item *ib = b;
+	if(ia->key[0] != ib->key[0]) return ia->key[0] < ib->key[0] ? -1 : +1;
+	if(ia->key[1] != ib->key[1]) return ia->key[1] < ib->key[1] ? -1 : +1;
+	if(ia->ent != ib->ent) return ia->ent < ib->ent ? -1 : +1;
+	return 0;
 }
 
 
-static int fn_comp_name(const void *a, const void *b)
+/*
+ * Stable LSD radix sort of n > 0 items on key[k], one byte per pass. Bytes
+ * which are the same for all items are skipped, so small sizes only take a
+ * few passes. Returns the buffer holding the result, items or tmp.
+ */
+
+static struct sort_item *radix_sort(struct sort_item *items, struct sort_item *tmp, size_t n, int k)
 {
-	const struct duc_dirent *ea = a;
-	const struct duc_dirent *eb = b;
-	return strcmp(ea->name, eb->name);
+	size_t hist[8][256];
+	size_t i;
+	int d, c;
+
+	memset(hist, 0, sizeof hist);
+	for(i=0; i<n; i++) {
+		uint64_t key = items[i].key[k];
+		for(d=0; d<8; d++) {
+			hist[d][(key >> (d * 8)) & 0xff] ++;
+		}
+	}
+
+	for(d=0; d<8; d++) {
+		size_t *h = hist[d];
+		if(h[(items[0].key[k] >> (d * 8)) & 0xff] == n) continue;
+
+		size_t off = 0;
+		for(c=0; c<256; c++) {
+			size_t l = h[c];
+			h[c] = off;
+			off += l;
+		}
+
+		for(i=0; i<n; i++) {
+			tmp[h[(items[i].key[k] >> (d * 8)) & 0xff] ++] = items[i];
+		}
+
+		struct sort_item *t = items;
+		items = tmp;
+		tmp = t;
+	}
+
+	return items;
 }
 
 
-struct duc_dirent *duc_dir_read(duc_dir *dir, duc_size_type st, duc_sort sort)
+static void sort_item_swap(struct sort_item *items, ssize_t a, ssize_t b)
 {
-	int (*fn_comp)(const void *, const void *);
+	struct sort_item t = items[a];
+	items[a] = items[b];
+	items[b] = t;
+}
 
-	dir->duc->err = 0;
-		
-	if(dir->size_type != st || dir->sort != sort) {
-		switch(sort) {
-		case DUC_SORT_SIZE:
-			switch(st) {
-			case DUC_SIZE_TYPE_APPARENT: 
-				fn_comp = fn_comp_apparent; 
-				break;
-			case DUC_SIZE_TYPE_ACTUAL: 
-				fn_comp = fn_comp_actual; 
-				break;
-			case DUC_SIZE_TYPE_COUNT: 
-				fn_comp = fn_comp_count; 
-				break;
+
+/*
+ * Quickselect: reorder the n items so the k smallest come first, in no
+ * particular order
+ */
+
+static void select_items(struct sort_item *items, size_t n, size_t k)
+{
+	ssize_t lo = 0;
+	ssize_t hi = n - 1;
+	ssize_t t = k - 1;
+
+	while(lo < hi) {
+
+		/* Median of three as pivot, also guards the scans below */
+
+		ssize_t mid = lo + (hi - lo) / 2;
+		if(sort_item_cmp(&items[mid], &items[lo]) < 0) sort_item_swap(items, mid, lo);
+		if(sort_item_cmp(&items[hi], &items[lo]) < 0) sort_item_swap(items, hi, lo);
+		if(sort_item_cmp(&items[hi], &items[mid]) < 0) sort_item_swap(items, hi, mid);
+		struct sort_item pivot = items[mid];
+
+		ssize_t i = lo;
+		ssize_t j = hi;
+		while(i <= j) {
+			while(sort_item_cmp(&items[i], &pivot) < 0) i++;
+			while(sort_item_cmp(&items[j], &pivot) > 0) j--;
+			if(i <= j) {
+				sort_item_swap(items, i, j);
+				i++;
+				j--;
 			}
-			break;
-		case DUC_SORT_NAME: 
-			fn_comp = fn_comp_name; 
+		}
+
+		if(t <= j) {
+			hi = j;
+		} else if(t >= i) {
+			lo = i;
+		} else {
 			break;
 		}
-		qsort(dir->ent_list, dir->ent_count, sizeof(struct duc_dirent), fn_comp);
-		dir->size_type = st;
-		dir->sort = sort;
 	}
+}
+
+
+/*
+ * Make sure the first k entries of dir->order are the k largest entries by
+ * size type st, largest first. A small k is handled by selecting the k
+ * largest and sorting only those; the full order is found with a radix sort,
+ * or taken from the ranks stored by the indexer for the default order.
+ */
+
+static void dir_order(duc_dir *dir, duc_size_type st, size_t k)
+{
+	size_t n = dir->ent_count;
+	size_t i;
+
+	if(k > n) k = n;
+	if(dir->size_type == st && dir->order_len >= k) return;
+
+	dir->size_type = st;
+	dir->order_len = 0;
+	if(n == 0) return;
 
-	if(dir->ent_cur < dir->ent_count) {
-		struct duc_dirent *ent = &dir->ent_list[dir->ent_cur];
-		dir->ent_cur ++;
-		return ent;
+	if(dir->order == NULL) {
+		dir->order = duc_malloc(n * sizeof(*dir->order));
+	}
+
+	if(dir->rank && st == DUC_SIZE_TYPE_ACTUAL) {
+		for(i=0; i<n; i++) {
+			dir->order[dir->rank[i]] = &dir->ent_list[i];
+		}
+		dir->order_len = n;
+		return;
+	}
+
+	struct sort_item *items = duc_malloc(n * sizeof(*items));
+	for(i=0; i<n; i++) {
+		sort_item_set(&items[i], &dir->ent_list[i], st);
+	}
+
+	if(k < n / 8) {
+		select_items(items, n, k);
+		qsort(items, k, sizeof(*items), sort_item_cmp);
+		for(i=0; i<k; i++) {
+			dir->order[i] = items[i].ent;
+		}
+		dir->order_len = k;
 	} else {
-		return NULL;
+		struct sort_item *tmp = duc_malloc(n * sizeof(*tmp));
+		struct sort_item *sorted = radix_sort(items, tmp, n, 1);
+		sorted = radix_sort(sorted, sorted == items ? tmp : items, n, 0);
+		for(i=0; i<n; i++) {
+			dir->order[i] = sorted[i].ent;
+		}
+		dir->order_len = n;
+		duc_free(tmp);
+	}
+
+	duc_free(items);
+}
+
+
+struct duc_dirent *duc_dir_read(duc_dir *dir, duc_size_type st, duc_sort sort)
+{
+	dir->duc->err = 0;
+
+	dir_load(dir);
+
+	if(dir->ent_cur >= dir->ent_count) return NULL;
+
+	if(sort == DUC_SORT_NAME) {
+		return &dir->ent_list[dir->ent_cur++];
 	}
+
+	dir_order(dir, st, dir->ent_count);
+	return dir->order[dir->ent_cur++];
+}
+
+
+/*
+ * Get the k largest entries by size type st, largest first, without sorting
+ * the whole directory. Returns a list of *count entries which stays valid
+ * until the next read or close of dir; the read position is not changed.
+ */
+
+struct duc_dirent **duc_dir_read_topk(duc_dir *dir, duc_size_type st, size_t k, size_t *count)
+{
+	dir->duc->err = 0;
+
+	dir_load(dir);
+	dir_order(dir, st, k);
+
+	*count = k < dir->ent_count ? k : dir->ent_count;
+	return dir->order;
 }
 
 
@@ -343,36 +684,14 @@ int duc_dir_rewind(duc_dir *dir)
 int duc_dir_close(duc_dir *dir)
 {
 	if(dir->path) free(dir->path);
-	size_t i;
-	for(i=0; i<dir->ent_count; i++) {
-		free(dir->ent_list[i].name);
-	}
-	free(dir->ent_list);
+	dir_release_record(dir);
+	if(dir->cached) dircache_release(dir->cached);
+	duc_free(dir->order);
 	free(dir);
 	return 0;
 }
 
 
-struct duc_index_report *duc_get_report(duc *duc, size_t id)
-{
-	size_t indexl;
-
-	char *index = db_get(duc->db, "duc_index_reports", 17, &indexl);
-	if(index == NULL) return NULL;
-
-	size_t report_count = indexl / DUC_PATH_MAX;
-	if(id >= report_count) return NULL;
-
-	char *path = index + id * DUC_PATH_MAX;
-
-	struct duc_index_report *r = db_read_report(duc, path);
-
-	free(index);
-
-	return r;
-} 
-
-
 /*
  * End
  */
@@ -0,0 +1,182 @@
+
+/*
+ * Cache of decoded directories, so drawing the same graph again or looking
+ * up a spot in it does not read and decode every directory again. Entries
+ * are reference counted: a directory evicted from the cache stays valid
+ * for the duc_dirs still using it. The least recently used entries are
+ * evicted when the cache grows beyond max bytes.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "duc.h"
+#include "private.h"
+#include "dircache.h"
+
+struct dircache {
+	struct dircache_ent *hash;
+	struct dircache_ent *head;  /* Most recently used */
+	struct dircache_ent *tail;
+	size_t max;
+	struct duc_cache_stats stats;
+};
+
+
+struct dircache *dircache_new(size_t max)
+{
+	struct dircache *c = duc_malloc0(sizeof *c);
+	c->max = max;
+	return c;
+}
+
+
+void dircache_free(struct dircache *c)
+{
+	dircache_flush(c);
+	duc_free(c);
+}
+
+
+static void make_key(uint64_t *key, const struct duc_devino *devino)
+{
+	key[0] = devino->dev;
+	key[1] = devino->ino;
+}
+
+
+static void lru_unlink(struct dircache *c, struct dircache_ent *ce)
+{
+	if(ce->prev) ce->prev->next = ce->next; else c->head = ce->next;
+	if(ce->next) ce->next->prev = ce->prev; else c->tail = ce->prev;
+	ce->prev = ce->next = NULL;
+}
+
+
+static void lru_push(struct dircache *c, struct dircache_ent *ce)
+{
+	ce->prev = NULL;
+	ce->next = c->head;
+	if(c->head) c->head->prev = ce; else c->tail = ce;
+	c->head = ce;
+}
+
+
+void dircache_release(struct dircache_ent *ce)
+{
+	if(--ce->refs == 0) {
+		duc_free(ce->ent_list);
+		duc_free(ce->rank);
+		duc_free(ce);
+	}
+}
+
+
+static void evict(struct dircache *c, struct dircache_ent *ce)
+{
+	HASH_DEL(c->hash, ce);
+	lru_unlink(c, ce);
+	c->stats.count --;
+	c->stats.bytes -= ce->bytes;
+	dircache_release(ce);
+}
+
+
+static void shrink(struct dircache *c, size_t max)
+{
+	while(c->tail && c->stats.bytes > max) {
+		evict(c, c->tail);
+	}
+}
+
+
+void dircache_set_max(struct dircache *c, size_t max)
+{
+	c->max = max;
+	shrink(c, max);
+}
+
+
+void dircache_flush(struct dircache *c)
+{
+	shrink(c, 0);
+}
+
+
+/*
+ * Find a directory, returns a new reference or NULL
+ */
+
+struct dircache_ent *dircache_get(struct dircache *c, const struct duc_devino *devino)
+{
+	struct dircache_ent *ce;
+	uint64_t key[2];
+
+	make_key(key, devino);
+	HASH_FIND(hh, c->hash, key, sizeof(key), ce);
+
+	if(ce == NULL) {
+		c->stats.misses ++;
+		return NULL;
+	}
+
+	c->stats.hits ++;
+	lru_unlink(c, ce);
+	lru_push(c, ce);
+	ce->refs ++;
+	return ce;
+}
+
+
+/*
+ * Wrap a decoded directory in an entry and add it to the cache if it fits.
+ * The entry takes over ent_list and rank, the caller gets a reference.
+ */
+
+struct dircache_ent *dircache_add(struct dircache *c, const struct duc_devino *devino,
+		const struct dir_header *h, struct duc_dirent *ent_list, uint64_t *rank)
+{
+	struct dircache_ent *ce = duc_malloc0(sizeof *ce);
+	size_t i;
+
+	make_key(ce->key, devino);
+	ce->header = *h;
+	ce->ent_list = ent_list;
+	ce->rank = rank;
+	ce->refs = 1;
+
+	ce->bytes = sizeof(*ce) + h->count * sizeof(*ent_list);
+	if(rank) ce->bytes += h->count * sizeof(*rank);
+	for(i=0; i<h->count; i++) {
+		ce->bytes += strlen(ent_list[i].name) + 1;
+	}
+
+	if(ce->bytes > c->max) return ce;
+
+	struct dircache_ent *old;
+	HASH_FIND(hh, c->hash, ce->key, sizeof(ce->key), old);
+	if(old) evict(c, old);
+
+	shrink(c, c->max - ce->bytes);
+
+	HASH_ADD(hh, c->hash, key, sizeof(ce->key), ce);
+	lru_push(c, ce);
+	ce->refs ++;
+	c->stats.count ++;
+	c->stats.bytes += ce->bytes;
+
+	return ce;
+}
+
+
+void dircache_get_stats(struct dircache *c, struct duc_cache_stats *stats)
+{
+	*stats = c->stats;
+}
+
+/*
+ * End
+ */
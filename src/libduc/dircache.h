@@ -0,0 +1,34 @@
+#ifndef dircache_h
+#define dircache_h
+
+#include "duc.h"
+#include "buffer.h"
+#include "uthash.h"
+
+/* Decoded contents of a directory record, shared by all open duc_dirs of
+ * the directory and the cache */
+struct dircache_ent {
+	uint64_t key[2];            /* dev and ino */
+	struct dir_header header;
+	struct duc_dirent *ent_list;        /* Sorted by name */
+	uint64_t *rank;
+	size_t bytes;
+	int refs;
+	struct dircache_ent *prev;
+	struct dircache_ent *next;
+	UT_hash_handle hh;
+};
+
+struct dircache;
+
+struct dircache *dircache_new(size_t max);
+void dircache_free(struct dircache *c);
+void dircache_set_max(struct dircache *c, size_t max);
+void dircache_flush(struct dircache *c);
+struct dircache_ent *dircache_get(struct dircache *c, const struct duc_devino *devino);
+struct dircache_ent *dircache_add(struct dircache *c, const struct duc_devino *devino,
+		const struct dir_header *h, struct duc_dirent *ent_list, uint64_t *rank);
+void dircache_release(struct dircache_ent *ce);
+void dircache_get_stats(struct dircache *c, struct duc_cache_stats *stats);
+
+#endif
@@ -16,6 +16,8 @@
 #include "private.h"
 #include "duc.h"
 #include "db.h"
+#include "dircache.h"
+#include "catalog.h"
 
 
 static void default_log_callback(duc_log_level level, const char *fmt, va_list va)
@@ -32,6 +34,7 @@ duc *duc_new(void)
 	memset(duc, 0, sizeof *duc);
 	duc->log_level = DUC_LOG_WRN;
 	duc->log_callback = default_log_callback;
+	duc->dircache = dircache_new(DUC_CACHE_SIZE_DEF);
 
 	return duc;
 }
@@ -40,6 +43,7 @@ duc *duc_new(void)
 void duc_del(duc *duc)
 {
 	if(duc->db) duc_close(duc);
+	dircache_free(duc->dircache);
 	free(duc);
 }
 
@@ -140,6 +144,15 @@ int duc_open(duc *duc, const char *path_db, duc_open_flags flags)
 		return -1;
 	    }
 	}
+
+	duc->err = db_check_version(duc, flags);
+	if(duc->err != DUC_OK) {
+		duc_log(duc, DUC_LOG_FTL, "Error opening: %s - %s", path_db, duc_strerror(duc));
+		db_close(duc->db);
+		duc->db = NULL;
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -147,6 +160,15 @@ int duc_open(duc *duc, const char *path_db, duc_open_flags flags)
 int duc_close(struct duc *duc)
 {
 	if(duc->db) {
+		struct duc_cache_stats stats;
+		dircache_get_stats(duc->dircache, &stats);
+		duc_log(duc, DUC_LOG_DBG, "Directory cache: %zu hits, %zu misses, %zu directories in %zu bytes",
+				stats.hits, stats.misses, stats.count, stats.bytes);
+		dircache_flush(duc->dircache);
+		if(duc->catalog) {
+			catalog_free(duc->catalog);
+			duc->catalog = NULL;
+		}
 		db_close(duc->db);
 		duc->db = NULL;
 	}
@@ -154,6 +176,22 @@ int duc_close(struct duc *duc)
 }
 
 
+/*
+ * Set the memory used for caching decoded directories, 0 disables the cache
+ */
+
+void duc_set_cache_size(duc *duc, size_t bytes)
+{
+	dircache_set_max(duc->dircache, bytes);
+}
+
+
+void duc_get_cache_stats(duc *duc, struct duc_cache_stats *stats)
+{
+	dircache_get_stats(duc->dircache, stats);
+}
+
+
 void duc_log(struct duc *duc, duc_log_level level, const char *fmt, ...)
 {
 	va_list va;
@@ -18,14 +18,24 @@
 #define DUC_HISTOGRAM_BUCKETS_MAX 512
 #define DUC_HISTOGRAM_BUCKETS_DEF 48
 
+/* Number of log2 buckets in the per directory histograms, one per bit of a 64 bit size */
+#define DUC_DIR_HISTOGRAM_BUCKETS 64
+
 /* Number of Largest files to track */
 #define DUC_TOPN_CNT 10
 /* Maximum number of topN files we can track, totally arbitrary... */
-#define DUC_TOPN_CNT_MAX 1000
+#define DUC_TOPN_CNT_MAX 100000
 
 /* minimum file size to track in topN list: 10 kilobytes */
 #define DUC_TOPN_MIN_FILE_SIZE 10240
 
+/* Directories up to this many levels below the indexed path can be opened
+ * by path with a single lookup */
+#define DUC_PATH_INDEX_DEPTH_DEF 3
+
+/* Memory for caching decoded directories: 32 megabytes */
+#define DUC_CACHE_SIZE_DEF (32 * 1024 * 1024)
+
 #ifdef WIN32
 typedef int64_t duc_dev_t;
 typedef int64_t duc_ino_t;
@@ -37,6 +47,8 @@ typedef ino_t duc_ino_t;
 typedef struct duc duc;
 typedef struct duc_dir duc_dir;
 typedef struct duc_index_req duc_index_req;
+typedef struct duc_catalog duc_catalog;
+typedef struct duc_report duc_report;
 
 typedef enum {
 	DUC_OPEN_RO = 1<<0,        /* Open read-only (for querying)*/
@@ -55,6 +67,10 @@ typedef enum {
 	DUC_INDEX_CHECK_HARD_LINKS = 1<<2, /* Count hard links only once during indexing */
 	DUC_INDEX_DRY_RUN          = 1<<3, /* Do not touch the database */
 	DUC_INDEX_TOPN_FILES       = 1<<4, /* Keep side DB of top N largest files */
+	DUC_INDEX_IO_URING         = 1<<5, /* Stat files in batches through io_uring */
+	DUC_INDEX_INCREMENTAL      = 1<<6, /* Reuse records of unchanged directories */
+	DUC_INDEX_DIR_HISTOGRAM    = 1<<7, /* Store a file size histogram for every directory */
+	DUC_INDEX_WRITE_BEHIND     = 1<<8, /* Write the database from a separate thread */
 } duc_index_flags;
 
 typedef enum {
@@ -116,8 +132,7 @@ struct duc_size {
 /* Track largest files found */
 
 typedef struct duc_topn_file {
-    // Should be dynamically allocated...
-    char name[DUC_PATH_MAX];
+    char *name;
     size_t size;
 } duc_topn_file;
 
@@ -134,7 +149,30 @@ struct duc_index_report {
         int topn_cnt_max;           /* Maximum number of topN files to track */
         int histogram_buckets;      /* Number of buckets in histogram */
         size_t histogram[DUC_HISTOGRAM_BUCKETS_MAX];      /* histogram of file sizes, log(size)/log(2) */
-        duc_topn_file* topn_array[DUC_TOPN_CNT_MAX];    /* pointer to array of structs, stores each topN filename and size */
+        duc_topn_file *topn_array;  /* topn_cnt entries sorted by size, the largest file last */
+	size_t hard_link_mem_peak;  /* Peak memory used for --check-hard-links, in bytes */
+	size_t write_queue_peak;    /* Most records waiting for the database writer */
+	struct timeval write_stall; /* Total time scanners waited for a full write queue */
+	uint64_t options_hash;      /* Hash of the options selecting the indexed files */
+};
+
+/* Summary of an index report, as kept in the report catalog */
+
+struct duc_report_info {
+	const char *path;           /* Indexed path */
+	struct duc_devino devino;   /* Index top device id and inode number */
+	struct timeval time_start;  /* Index start time */
+	struct timeval time_stop;   /* Index finished time */
+	size_t file_count;          /* Total number of files indexed */
+	size_t dir_count;           /* Total number of directories indexed */
+	struct duc_size size;       /* Total size */
+};
+
+struct duc_cache_stats {
+	size_t hits;                /* Directories found in the cache */
+	size_t misses;              /* Directories read from the database */
+	size_t count;               /* Directories in the cache */
+	size_t bytes;               /* Memory used by the cached directories */
 };
 
 struct duc_dirent {
@@ -160,6 +198,9 @@ void duc_set_log_callback(duc *duc, duc_log_callback cb);
 duc_errno duc_error(duc *duc);
 const char *duc_strerror(duc *duc);
 
+void duc_set_cache_size(duc *duc, size_t bytes);
+void duc_get_cache_stats(duc *duc, struct duc_cache_stats *stats);
+
 
 /*
  * Open and close database
@@ -185,6 +226,8 @@ int duc_index_req_set_maxdepth(duc_index_req *req, int maxdepth);
 int duc_index_req_set_progress_cb(duc_index_req *req, duc_index_progress_cb fn, void *ptr);
 int duc_index_req_set_topn(duc_index_req *req, int topn);
 int duc_index_req_set_buckets(duc_index_req *req, int topn);
+int duc_index_req_set_threads(duc_index_req *req, int threads);
+int duc_index_req_set_path_depth(duc_index_req *req, int depth);
 struct duc_index_report *duc_index(duc_index_req *req, const char *path, duc_index_flags flags);
 int duc_index_req_free(duc_index_req *req);
 int duc_index_report_free(struct duc_index_report *rep);
@@ -196,13 +239,26 @@ int duc_index_report_free(struct duc_index_report *rep);
 
 struct duc_index_report *duc_get_report(duc *duc, size_t id);
 
+duc_catalog *duc_catalog_open(duc *duc);
+const struct duc_report_info *duc_catalog_read(duc_catalog *cat);
+duc_report *duc_catalog_get_report(duc_catalog *cat);
+int duc_catalog_close(duc_catalog *cat);
+
+duc_report *duc_report_open(duc *duc, const char *path);
+const struct duc_report_info *duc_report_get_info(duc_report *report);
+const size_t *duc_report_get_histogram(duc_report *report, size_t *buckets);
+const duc_topn_file *duc_report_get_topn(duc_report *report, size_t *count);
+int duc_report_close(duc_report *report);
+
 duc_dir *duc_dir_open(duc *duc, const char *path);
 duc_dir *duc_dir_openat(duc_dir *dir, const char *name);
 duc_dir *duc_dir_openent(duc_dir *dir, const struct duc_dirent *e);
 struct duc_dirent *duc_dir_read(duc_dir *dir, duc_size_type st, duc_sort sort);
+struct duc_dirent **duc_dir_read_topk(duc_dir *dir, duc_size_type st, size_t k, size_t *count);
 char *duc_dir_get_path(duc_dir *dir);
 void duc_dir_get_size(duc_dir *dir, struct duc_size *size);
 size_t duc_dir_get_count(duc_dir *dir);
+int duc_dir_get_histogram(duc_dir *dir, size_t *histogram, int buckets);
 struct duc_dirent *duc_dir_find_child(duc_dir *dir, const char *name);
 int duc_dir_seek(duc_dir *dir, size_t offset);
 int duc_dir_rewind(duc_dir *dir);
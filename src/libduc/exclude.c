@@ -0,0 +1,295 @@
+
+/*
+ * Exclude patterns, compiled once when added so matching a directory entry
+ * does not need a fnmatch() call for every pattern:
+ *
+ * - literal names ("CVS", ".git") go into a hash
+ * - prefix patterns ("core.*") and suffix patterns ("*.o") go into tries,
+ *   the latter storing the names reversed
+ * - everything else is matched with fnmatch()
+ *
+ * Patterns containing a '/' are anchored: they are matched against the
+ * path of the entry relative to the indexed directory, with '*' not
+ * matching a '/'. A leading or trailing '/' is ignored, so "/build" only
+ * excludes the top level 'build' directory and "src/" followed by "*.o"
+ * only the object files directly inside 'src'.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_FNMATCH_H
+#include <fnmatch.h>
+#endif
+
+#include "duc.h"
+#include "private.h"
+#include "uthash.h"
+#include "exclude.h"
+
+struct trie {
+	struct trie *child;         /* First child */
+	struct trie *next;          /* Next sibling */
+	unsigned char c;
+	int end;                    /* A pattern ends here */
+};
+
+struct literal {
+	char *name;
+	UT_hash_handle hh;
+};
+
+struct glob_list {
+	char **patt;
+	size_t count;
+	size_t max;
+};
+
+struct exclude_set {
+	struct literal *names;
+	struct trie prefix;
+	struct trie suffix;
+	struct glob_list globs;
+	struct literal *paths;
+	struct glob_list path_globs;
+};
+
+
+struct exclude_set *exclude_set_new(void)
+{
+	return duc_malloc0(sizeof(struct exclude_set));
+}
+
+
+static void trie_free(struct trie *t)
+{
+	struct trie *c, *cn;
+
+	for(c=t->child; c; c=cn) {
+		cn = c->next;
+		trie_free(c);
+		duc_free(c);
+	}
+}
+
+
+static void literal_free(struct literal **list)
+{
+	struct literal *l, *ln;
+
+	HASH_ITER(hh, *list, l, ln) {
+		HASH_DEL(*list, l);
+		duc_free(l->name);
+		duc_free(l);
+	}
+}
+
+
+static void glob_free(struct glob_list *g)
+{
+	size_t i;
+
+	for(i=0; i<g->count; i++) {
+		duc_free(g->patt[i]);
+	}
+	duc_free(g->patt);
+}
+
+
+void exclude_set_free(struct exclude_set *s)
+{
+	literal_free(&s->names);
+	literal_free(&s->paths);
+	trie_free(&s->prefix);
+	trie_free(&s->suffix);
+	glob_free(&s->globs);
+	glob_free(&s->path_globs);
+	duc_free(s);
+}
+
+
+/*
+ * Add string of len bytes to the trie, walking it backwards when step is -1
+ */
+
+static void trie_add(struct trie *t, const char *s, size_t len, int step)
+{
+	const unsigned char *p = (const unsigned char *)(step > 0 ? s : s + len - 1);
+	size_t i;
+
+	for(i=0; i<len; i++) {
+		struct trie *c;
+		for(c=t->child; c; c=c->next) {
+			if(c->c == *p) break;
+		}
+		if(c == NULL) {
+			c = duc_malloc0(sizeof *c);
+			c->c = *p;
+			c->next = t->child;
+			t->child = c;
+		}
+		t = c;
+		p += step;
+	}
+
+	t->end = 1;
+}
+
+
+/*
+ * Returns 1 if any string in the trie is a prefix of s, or a suffix when
+ * step is -1
+ */
+
+static int trie_match(const struct trie *t, const char *s, size_t len, int step)
+{
+	const unsigned char *p = (const unsigned char *)(step > 0 ? s : s + len - 1);
+	size_t i;
+
+	if(t->end) return 1;
+
+	for(i=0; i<len; i++) {
+		const struct trie *c;
+		for(c=t->child; c; c=c->next) {
+			if(c->c == *p) break;
+		}
+		if(c == NULL) return 0;
+		if(c->end) return 1;
+		t = c;
+		p += step;
+	}
+
+	return 0;
+}
+
+
+static void literal_add(struct literal **list, const char *name, size_t len)
+{
+	struct literal *l;
+
+	HASH_FIND(hh, *list, name, len, l);
+	if(l) return;
+
+	l = duc_malloc(sizeof *l);
+	l->name = duc_malloc(len + 1);
+	memcpy(l->name, name, len);
+	l->name[len] = '\0';
+	HASH_ADD_KEYPTR(hh, *list, l->name, len, l);
+}
+
+
+static void glob_add(struct glob_list *g, const char *patt, size_t len)
+{
+	if(g->count == g->max) {
+		g->max = g->max ? g->max * 2 : 16;
+		g->patt = duc_realloc(g->patt, g->max * sizeof(*g->patt));
+	}
+	char *p = duc_malloc(len + 1);
+	memcpy(p, patt, len);
+	p[len] = '\0';
+	g->patt[g->count++] = p;
+}
+
+
+static int glob_match(const struct glob_list *g, const char *s, int flags)
+{
+	size_t i;
+
+	for(i=0; i<g->count; i++) {
+#ifdef HAVE_FNMATCH_H
+		if(fnmatch(g->patt[i], s, flags) == 0) return 1;
+#else
+		if(strstr(s, g->patt[i]) != NULL) return 1;
+#endif
+	}
+
+	return 0;
+}
+
+
+static int has_wildcard(const char *s, size_t len)
+{
+	size_t i;
+
+	for(i=0; i<len; i++) {
+		switch(s[i]) {
+			case '*': case '?': case '[': case '\\':
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+void exclude_set_add(struct exclude_set *s, const char *patt)
+{
+	size_t len = strlen(patt);
+
+	if(strchr(patt, '/')) {
+
+		while(*patt == '/') {
+			patt ++;
+			len --;
+		}
+		while(len > 0 && patt[len-1] == '/') len --;
+		if(len == 0) return;
+
+		if(!has_wildcard(patt, len)) {
+			literal_add(&s->paths, patt, len);
+		} else {
+			glob_add(&s->path_globs, patt, len);
+		}
+
+	} else if(!has_wildcard(patt, len)) {
+		literal_add(&s->names, patt, len);
+	} else if(patt[len-1] == '*' && !has_wildcard(patt, len - 1)) {
+		trie_add(&s->prefix, patt, len - 1, 1);
+	} else if(patt[0] == '*' && !has_wildcard(patt + 1, len - 1)) {
+		trie_add(&s->suffix, patt + 1, len - 1, -1);
+	} else {
+		glob_add(&s->globs, patt, len);
+	}
+}
+
+
+/*
+ * Check if the entry 'name' in directory 'dir' is excluded. The directory
+ * is given relative to the indexed path, and is empty for the top level.
+ */
+
+int exclude_set_match(struct exclude_set *s, const char *name, const char *dir)
+{
+	struct literal *l;
+	size_t len = strlen(name);
+
+	HASH_FIND(hh, s->names, name, len, l);
+	if(l) return 1;
+	if(trie_match(&s->prefix, name, len, 1)) return 1;
+	if(trie_match(&s->suffix, name, len, -1)) return 1;
+	if(glob_match(&s->globs, name, 0)) return 1;
+
+	if(s->paths || s->path_globs.count) {
+		char path[DUC_PATH_MAX];
+		if(dir[0]) {
+			snprintf(path, sizeof(path), "%s/%s", dir, name);
+		} else {
+			snprintf(path, sizeof(path), "%s", name);
+		}
+		HASH_FIND_STR(s->paths, path, l);
+		if(l) return 1;
+#ifdef HAVE_FNMATCH_H
+		if(glob_match(&s->path_globs, path, FNM_PATHNAME)) return 1;
+#else
+		if(glob_match(&s->path_globs, path, 0)) return 1;
+#endif
+	}
+
+	return 0;
+}
+
+/*
+ * End
+ */
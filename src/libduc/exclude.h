@@ -0,0 +1,11 @@
+#ifndef exclude_h
+#define exclude_h
+
+struct exclude_set;
+
+struct exclude_set *exclude_set_new(void);
+void exclude_set_free(struct exclude_set *s);
+void exclude_set_add(struct exclude_set *s, const char *patt);
+int exclude_set_match(struct exclude_set *s, const char *name, const char *dir);
+
+#endif
@@ -0,0 +1,179 @@
+
+/*
+ * Set of dev/inode pairs, used to count files with multiple hard links only
+ * once. Entries are stored in flat open addressing tables with linear
+ * probing, without any per entry allocation. The set is split in shards
+ * by hash, each with its own lock, so scanner threads rarely contend.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "duc.h"
+#include "private.h"
+#include "hardlink.h"
+
+#define SHARD_BITS 6
+#define SHARD_COUNT (1 << SHARD_BITS)
+#define SHARD_SIZE_MIN 1024
+
+struct shard {
+	pthread_mutex_t mutex;
+	struct duc_devino *slot;    /* Slots with dev and ino both 0 are empty */
+	size_t size;                /* Number of slots, power of two */
+	size_t count;
+	int has_zero;               /* The 0/0 devino itself was added */
+};
+
+struct hardlink_table {
+	struct shard shard[SHARD_COUNT];
+	size_t mem;
+	size_t mem_peak;
+};
+
+
+static uint64_t hash(const struct duc_devino *devino)
+{
+	uint64_t h = (uint64_t)devino->ino ^ ((uint64_t)devino->dev * 0x9e3779b97f4a7c15ULL);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+
+static int is_empty(const struct duc_devino *devino)
+{
+	return devino->dev == 0 && devino->ino == 0;
+}
+
+
+static void mem_add(struct hardlink_table *t, ssize_t n)
+{
+	size_t mem = __sync_add_and_fetch(&t->mem, n);
+	size_t peak = __atomic_load_n(&t->mem_peak, __ATOMIC_RELAXED);
+	while(mem > peak && !__atomic_compare_exchange_n(&t->mem_peak, &peak, mem, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+
+/*
+ * Insert in a table known to have room, returns 1 if already present
+ */
+
+static int shard_insert(struct shard *s, uint64_t h, const struct duc_devino *devino)
+{
+	size_t mask = s->size - 1;
+	size_t i = h & mask;
+
+	for(;;) {
+		struct duc_devino *slot = &s->slot[i];
+		if(is_empty(slot)) {
+			*slot = *devino;
+			s->count ++;
+			return 0;
+		}
+		if(slot->dev == devino->dev && slot->ino == devino->ino) {
+			return 1;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+
+static void shard_grow(struct hardlink_table *t, struct shard *s)
+{
+	struct duc_devino *slot_old = s->slot;
+	size_t size_old = s->size;
+	size_t i;
+
+	s->size = size_old ? size_old * 2 : SHARD_SIZE_MIN;
+	s->slot = duc_malloc0(s->size * sizeof(*s->slot));
+	s->count = 0;
+	mem_add(t, s->size * sizeof(*s->slot));
+
+	for(i=0; i<size_old; i++) {
+		if(!is_empty(&slot_old[i])) {
+			shard_insert(s, hash(&slot_old[i]) >> SHARD_BITS, &slot_old[i]);
+		}
+	}
+
+	duc_free(slot_old);
+	mem_add(t, -(ssize_t)(size_old * sizeof(*s->slot)));
+}
+
+
+struct hardlink_table *hardlink_table_new(void)
+{
+	struct hardlink_table *t = duc_malloc0(sizeof *t);
+	int i;
+
+	for(i=0; i<SHARD_COUNT; i++) {
+		pthread_mutex_init(&t->shard[i].mutex, NULL);
+	}
+	mem_add(t, sizeof *t);
+
+	return t;
+}
+
+
+void hardlink_table_free(struct hardlink_table *t)
+{
+	int i;
+
+	for(i=0; i<SHARD_COUNT; i++) {
+		pthread_mutex_destroy(&t->shard[i].mutex);
+		duc_free(t->shard[i].slot);
+	}
+	duc_free(t);
+}
+
+
+/*
+ * Add devino to the set. Returns 1 if it was seen before
+ */
+
+int hardlink_table_add(struct hardlink_table *t, const struct duc_devino *devino)
+{
+	uint64_t h = hash(devino);
+	struct shard *s = &t->shard[h & (SHARD_COUNT - 1)];
+	int dup;
+
+	pthread_mutex_lock(&s->mutex);
+
+	if(is_empty(devino)) {
+		dup = s->has_zero;
+		s->has_zero = 1;
+	} else {
+		/* Keep the load factor below 3/4 */
+		if((s->count + 1) * 4 > s->size * 3) {
+			shard_grow(t, s);
+		}
+		dup = shard_insert(s, h >> SHARD_BITS, devino);
+	}
+
+	pthread_mutex_unlock(&s->mutex);
+
+	return dup;
+}
+
+
+/*
+ * Highest number of bytes used by the table, including the moments both old
+ * and new slot arrays exist while growing a shard
+ */
+
+size_t hardlink_table_mem_peak(struct hardlink_table *t)
+{
+	return __atomic_load_n(&t->mem_peak, __ATOMIC_RELAXED);
+}
+
+/*
+ * End
+ */
@@ -0,0 +1,13 @@
+#ifndef hardlink_h
+#define hardlink_h
+
+#include "duc.h"
+
+struct hardlink_table;
+
+struct hardlink_table *hardlink_table_new(void);
+void hardlink_table_free(struct hardlink_table *t);
+int hardlink_table_add(struct hardlink_table *t, const struct duc_devino *devino);
+size_t hardlink_table_mem_peak(struct hardlink_table *t);
+
+#endif
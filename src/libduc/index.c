@@ -1,4 +1,3 @@
-
 /*
  * To whom it may concern: http://womble.decadent.org.uk/readdir_r-advisory.html
  */
@@ -15,24 +14,25 @@
 #include <errno.h>
 #include <dirent.h>
 #include <time.h>
-#include <math.h>
 #include <sys/time.h>
 #include <unistd.h>
-#ifdef HAVE_FNMATCH_H
-#include <fnmatch.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#ifdef HAVE_SYS_SYSMACROS_H
+#include <sys/sysmacros.h>
 #endif
 
 #include "db.h"
 #include "duc.h"
 #include "private.h"
 #include "uthash.h"
-#include "utlist.h"
 #include "buffer.h"
-
-struct hard_link {
-	struct duc_devino devino;
-	UT_hash_handle hh;
-};
+#include "scan.h"
+#include "hardlink.h"
+#include "topn.h"
+#include "exclude.h"
+#include "dircache.h"
+#include "catalog.h"
 
 struct fstype {
 	char *path;
@@ -40,19 +40,31 @@ struct fstype {
 	UT_hash_handle hh;
 };
 
-struct exclude {
-	char *name;
-	struct exclude *next;
+/*
+ * File system type and include/exclude decision of a device, so crossing
+ * into a file system only costs a lookup by device number
+ */
+
+struct fsdev {
+	duc_dev_t dev;
+	char *type;
+	const char *deny;           /* Reason to skip, NULL if allowed */
+	UT_hash_handle hh;
 };
 
 struct duc_index_req {
 	duc *duc;
-	struct exclude *exclude_list;
+	struct exclude_set *exclude;
+	uint64_t exclude_hash;      /* Sum of the hashes of the exclude patterns */
+	size_t root_len;            /* Length of the indexed path */
+	uint64_t stamp;             /* Start time in microseconds, for the path index */
+	int path_depth;
 	duc_dev_t dev;
 	duc_index_flags flags;
 	int maxdepth;
         int topn_cnt;
         int histogram_buckets;
+        int thread_count;
         uid_t uid;
         const char *username;
 	duc_index_progress_cb progress_fn;
@@ -60,17 +72,51 @@ struct duc_index_req {
 	int progress_n;
 	struct timeval progress_interval;
 	struct timeval progress_time;
-	struct hard_link *hard_link_map;
+	time_t incremental_since;
+	struct hardlink_table *hard_links;
+	struct topn *topn;
 	struct fstype *fstypes_mounted;
 	struct fstype *fstypes_include;
 	struct fstype *fstypes_exclude;
+	struct fsdev *fsdevs;
+	pthread_mutex_t mutex_fsdev;
+	struct pool *pool;
+};
+
+
+/*
+ * A scanner holds the state of one directory. Directory entries are
+ * collected in ent_list; subdirectories get a slot pointing to their own
+ * scanner, which is filled in when the child is finished. The record is
+ * sorted by name when written, so it does not depend on the order in which
+ * the children are scanned. With --check-hard-links only the first link
+ * seen is counted, and with more than one thread which link that is depends
+ * on scheduling, so directory totals can differ between runs.
+ */
+
+struct scanner_ent {
+	struct duc_dirent ent;
+	struct scanner *child;
 };
 
 struct scanner {
 	struct scanner *parent;
 	int depth;
-	DIR *d;
-	struct buffer *buffer;
+	int pending;                /* Own scan plus number of unfinished children */
+	int skip;                   /* Directory could not be read, drop from parent */
+	char *path;                 /* Full path of this directory */
+	struct scan_dir *d;
+	int unopened;               /* Own scan plus number of children not yet opened */
+	int by_path;                /* Open by full path, not relative to the parent */
+	int path_truncated;         /* Path did not fit in DUC_PATH_MAX */
+	uid_t uid;
+	nlink_t nlink;
+	time_t mtime;
+	struct duc_devino devino_parent;
+	size_t *histogram;          /* Histogram of the subtree, with DUC_INDEX_DIR_HISTOGRAM */
+	struct scanner_ent *ent_list;
+	size_t ent_count;
+	size_t ent_max;
 	struct duc *duc;
 	struct duc_index_req *req;
 	struct duc_index_report *rep;
@@ -78,7 +124,89 @@ struct scanner {
 };
 
 
+/*
+ * Totals gathered by a worker while scanning a directory. These are added
+ * to the shared report after each directory to keep lock traffic low.
+ */
+
+struct scanner_stats {
+	size_t file_count;
+	size_t dir_count;
+	struct duc_size size;
+	size_t histogram[DUC_HISTOGRAM_BUCKETS_MAX];
+};
+
+
+/*
+ * Each worker owns a deque of directories waiting to be scanned. The owner
+ * pushes and pops at the tail, idle workers steal from the head so they
+ * pick up the directories closest to the root, which tend to be the
+ * largest subtrees.
+ */
+
+struct worker {
+	struct pool *pool;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	struct scanner **queue;
+	size_t queue_head;
+	size_t queue_tail;
+	size_t queue_max;
+	struct scanner_stats stats;
+	struct scan_batch *batch;
+	struct topn *topn;
+};
+
+
+/*
+ * Finished directory record, handed from the workers to the thread doing
+ * the database writes. Records are collected and written in batches of
+ * about RECORD_BATCH_BYTES.
+ */
+
+#define RECORD_BATCH_BYTES (1024 * 1024)
+
+/* With a separate writer the queue is bounded, scanners wait for the
+ * writer when this many bytes are pending */
+
+#define RECORD_QUEUE_BYTES (32 * 1024 * 1024)
+
+struct record {
+	struct buffer *buffer;
+	struct record *next;
+	size_t keyl;
+	char key[];
+};
+
+struct pool {
+	struct duc_index_req *req;
+	struct worker *worker_list;
+	int worker_count;
+	int threaded;
+	int idle;
+	int done;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_work;
+	pthread_cond_t cond_write;
+	pthread_cond_t cond_space;
+	pthread_mutex_t mutex_report;
+	pthread_mutex_t mutex_db;
+	struct record *record_head;
+	struct record *record_tail;
+	size_t record_bytes;
+	size_t record_count;
+	size_t record_peak;
+	int record_waiting;         /* Scanners waiting for room in the queue */
+	int dir_open;               /* Directory handles currently open */
+	int dir_max;                /* Above this children are opened by path */
+	struct timeval write_stall;
+	struct db_record *db_list;
+	size_t db_list_max;
+};
+
+
 static void scanner_free(struct scanner *scanner);
+static void scanner_free_entries(struct scanner *scanner);
 
 
 duc_index_req *duc_index_req_new(duc *duc)
@@ -88,21 +216,25 @@ duc_index_req *duc_index_req_new(duc *duc)
 	req->duc = duc;
 	req->progress_interval.tv_sec = 0;
 	req->progress_interval.tv_usec = 100 * 1000;
-	req->hard_link_map = NULL;
 	req->topn_cnt = DUC_TOPN_CNT;
+	req->thread_count = 1;
+	req->path_depth = DUC_PATH_INDEX_DEPTH_DEF;
+	pthread_mutex_init(&req->mutex_fsdev, NULL);
 	return req;
 }
 
 
 int duc_index_req_free(duc_index_req *req)
 {
-	struct hard_link *h, *hn;
 	struct fstype *f, *fn;
-	struct exclude *e, *en;
+	struct fsdev *d, *dn;
+
+	if(req->exclude) {
+		exclude_set_free(req->exclude);
+	}
 
-	HASH_ITER(hh, req->hard_link_map, h, hn) {
-		HASH_DEL(req->hard_link_map, h);
-		free(h);
+	if(req->hard_links) {
+		hardlink_table_free(req->hard_links);
 	}
 	
 	HASH_ITER(hh, req->fstypes_mounted, f, fn) {
@@ -112,6 +244,13 @@ int duc_index_req_free(duc_index_req *req)
 		free(f);
 	}
 	
+	HASH_ITER(hh, req->fsdevs, d, dn) {
+		duc_free(d->type);
+		HASH_DEL(req->fsdevs, d);
+		duc_free(d);
+	}
+	pthread_mutex_destroy(&req->mutex_fsdev);
+	
 	HASH_ITER(hh, req->fstypes_include, f, fn) {
 		duc_free(f->type);
 		HASH_DEL(req->fstypes_include, f);
@@ -124,22 +263,70 @@ int duc_index_req_free(duc_index_req *req)
 		free(f);
 	}
 
-	LL_FOREACH_SAFE(req->exclude_list, e, en) {
-		free(e->name);
-		free(e);
-	}
-
 	free(req);
 
 	return 0;
 }
 
 
+/*
+ * Hash of an option value, tagged with the kind of option. The hashes of
+ * all options deciding which files are indexed are summed into the
+ * options_hash of the report, so the order they are given in does not
+ * matter. No options give a hash of 0, as in reports written before it
+ * was stored.
+ */
+
+static uint64_t option_hash(char kind, const char *val)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	h = (h ^ (uint8_t)kind) * 0x100000001b3ULL;
+	while(*val) {
+		h = (h ^ (uint8_t)*val++) * 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+
+static uint64_t options_hash(duc_index_req *req, duc_index_flags flags)
+{
+	uint64_t h = req->exclude_hash;
+	struct fstype *fstype, *tmp;
+	char buf[32];
+
+	HASH_ITER(hh, req->fstypes_include, fstype, tmp) {
+		h += option_hash('i', fstype->type);
+	}
+	HASH_ITER(hh, req->fstypes_exclude, fstype, tmp) {
+		h += option_hash('e', fstype->type);
+	}
+	if(req->username) {
+		snprintf(buf, sizeof(buf), "%d", (int)req->uid);
+		h += option_hash('u', buf);
+	}
+	if(req->maxdepth) {
+		snprintf(buf, sizeof(buf), "%d", req->maxdepth);
+		h += option_hash('d', buf);
+	}
+	flags &= (DUC_INDEX_XDEV | DUC_INDEX_HIDE_FILE_NAMES | DUC_INDEX_CHECK_HARD_LINKS);
+	if(flags) {
+		snprintf(buf, sizeof(buf), "%d", (int)flags);
+		h += option_hash('f', buf);
+	}
+
+	return h;
+}
+
+
 int duc_index_req_add_exclude(duc_index_req *req, const char *patt)
 {
-	struct exclude *e = duc_malloc(sizeof(struct exclude));
-	e->name = duc_strdup(patt);
-	LL_APPEND(req->exclude_list, e);
+	if(req->exclude == NULL) {
+		req->exclude = exclude_set_new();
+	}
+	exclude_set_add(req->exclude, patt);
+	req->exclude_hash += option_hash('x', patt);
 	return 0;
 }
 
@@ -192,6 +379,19 @@ int duc_index_req_set_buckets(duc_index_req *req, int cnt)
 	return 0;
 }
 
+int duc_index_req_set_path_depth(duc_index_req *req, int depth)
+{
+	req->path_depth = depth;
+	return 0;
+}
+
+int duc_index_req_set_threads(duc_index_req *req, int cnt)
+{
+	if(cnt < 1) cnt = 1;
+	req->thread_count = cnt;
+	return 0;
+}
+
 /* We set both uid and username, since we cannot use -1 UID to check wether we're 
    limiting the search to just a specific UID, but we use UID for quicker compares. */
 
@@ -222,20 +422,6 @@ int duc_index_req_set_progress_cb(duc_index_req *req, duc_index_progress_cb fn,
 }
 
 
-static int match_exclude(const char *name, struct exclude *list)
-{
-	struct exclude *e;
-	LL_FOREACH(list, e) {
-#ifdef HAVE_FNMATCH_H
-		if(fnmatch(e->name, name, 0) == 0) return 1;
-#else
-		if(strstr(name, e->name) == 0) return 1;
-#endif
-	}
-	return 0;
-}
-
-
 /*
  * Convert st_mode to DUC_FILE_TYPE_* type
  */
@@ -279,7 +465,7 @@ static void st_to_devino(struct stat *st, struct duc_devino *devino)
 #ifdef WIN32
 	static duc_ino_t ino_seq = 0;
 	devino->dev = st->st_dev;
-	devino->ino = ++ino_seq;
+	devino->ino = __sync_add_and_fetch(&ino_seq, 1);
 #else
 	devino->dev = st->st_dev;
 	devino->ino = st->st_ino;
@@ -294,86 +480,36 @@ static void st_to_devino(struct stat *st, struct duc_devino *devino)
 
 static int is_duplicate(struct duc_index_req *req, struct duc_devino *devino)
 {
-	struct hard_link *h;
-	HASH_FIND(hh, req->hard_link_map, devino, sizeof(*devino), h);
-	if(h) return 1;
-
-	h = duc_malloc(sizeof *h);
-	h->devino = *devino;
-	HASH_ADD(hh, req->hard_link_map, devino, sizeof(h->devino), h);
-	return 0;
-}
-
-/* Sorts so smallest ends up in array[0] where we will ignore it. */
-int topn_comp(const void *a, const void *b) {
-
-    struct duc_topn_file* AA = *(struct duc_topn_file **)a;
-    struct duc_topn_file* BB = *(struct duc_topn_file **)b;
-
-    if (BB->size > AA->size) return -1;
-    if (BB->size < AA->size) return 1;
-    return 0;
-}
-
-// put data into Struct in array[0], sort array, smallest size ends up in array[0]
-int duc_topn_add(duc_topn_file *array, const void *path, size_t size, int topn_cnt) {
-
+	return hardlink_table_add(req->hard_links, devino);
 }
 
 
-static void report_skip(struct duc *duc, const char *name, const char *fmt, ...)
+static void report_skip(struct duc *duc, const char *path, const char *fmt, ...)
 {
-	char path_full[DUC_PATH_MAX];
 	char msg[DUC_PATH_MAX + 128];
-	char *res = realpath(name, path_full);
-	if (res == NULL) {
-	    duc_log(duc, DUC_LOG_WRN, "Cannot determine realpath of: %s", name);
-	}
 	va_list va;
 	va_start(va, fmt);
 	vsnprintf(msg, sizeof(msg), fmt, va);
-	duc_log(duc, DUC_LOG_WRN, "skipping %s: %s", path_full, msg);
+	duc_log(duc, DUC_LOG_WRN, "skipping %s: %s", path, msg);
 	va_end(va);
 }
 
 
 /*
- * Check if this file system type should be scanned, depending on the
- * fstypes_include and fstypes_exclude lists. If neither has any entries, all
- * fs types are allowed. return 0 to skip, or 1 to scan
+ * Check the file system type against the fstypes_include and
+ * fstypes_exclude lists. Returns NULL if allowed, or the reason to skip
  */
 
-static int is_fstype_allowed(struct duc_index_req *req, const char *name)
+static const char *fstype_deny(struct duc_index_req *req, const char *type)
 {
-	struct duc *duc = req->duc;
-
-	if((req->fstypes_include == NULL) && (req->fstypes_exclude == NULL)) {
-		return 1;
-	}
-
-	/* Find file system type */
-
-	char path_full[DUC_PATH_MAX];
-        char *res = realpath(name, path_full);
-	if (res == NULL) {
-	    report_skip(duc, name, "Cannot determine realpath result");
-            return 0;
-	}
-	struct fstype *fstype = NULL;
-	HASH_FIND_STR(req->fstypes_mounted, path_full, fstype);
-	if(fstype == NULL) {
-		report_skip(duc, name, "Unable to determine fs type");
-		return 0;
-	}
-	const char *type = fstype->type;
+	struct fstype *fstype;
 
 	/* Check if excluded */
 
 	if(req->fstypes_exclude) {
 		HASH_FIND_STR(req->fstypes_exclude, type, fstype);
 		if(fstype) {
-			report_skip(duc, name, "File system type '%s' is excluded", type);
-			return 0;
+			return "File system type '%s' is excluded";
 		}
 	}
 
@@ -382,293 +518,1182 @@ static int is_fstype_allowed(struct duc_index_req *req, const char *name)
 	if(req->fstypes_include) {
 		HASH_FIND_STR(req->fstypes_include, type, fstype);
 		if(!fstype) {
-			report_skip(duc, name, "File system type '%s' is not included", type);
-			return 0;
+			return "File system type '%s' is not included";
 		}
 	}
 
-	return 1;
+	return NULL;
 }
 
 
-/* 
- * Open dir and read file status 
+/*
+ * Add the decision for a device, keeping the existing one if already known
  */
 
-static struct scanner *scanner_new(struct duc *duc, struct scanner *scanner_parent, const char *path, struct stat *st)
+static struct fsdev *fsdev_add(struct duc_index_req *req, duc_dev_t dev, const char *type)
 {
-	struct scanner *scanner;
-	scanner = duc_malloc0(sizeof *scanner);
-
-	struct stat st2;
-	struct duc_devino devino_parent = { 0, 0 };
-
-	if(scanner_parent) {
-		scanner->depth = scanner_parent->depth + 1;
-		scanner->duc = scanner_parent->duc;
-		scanner->req = scanner_parent->req;
-		scanner->rep = scanner_parent->rep;
-		devino_parent = scanner_parent->ent.devino;
-	} else {
-		int r = lstat(path, &st2);
-		if(r == -1) {
-			duc_log(duc, DUC_LOG_WRN, "Error statting %s: %s", path, strerror(errno));
-			goto err;
-		}
-		st = &st2;
+	struct fsdev *fsdev;
+
+	HASH_FIND(hh, req->fsdevs, &dev, sizeof(dev), fsdev);
+	if(fsdev == NULL) {
+		fsdev = duc_malloc0(sizeof *fsdev);
+		fsdev->dev = dev;
+		fsdev->type = duc_strdup(type);
+		fsdev->deny = fstype_deny(req, type);
+		HASH_ADD(hh, req->fsdevs, dev, sizeof(fsdev->dev), fsdev);
 	}
-	
-	scanner->d = opendir(path);
-	if(scanner->d == NULL) {
-		report_skip(duc, path, strerror(errno));
-		goto err;
-	}
-	
-	scanner->duc = duc;
-	scanner->parent = scanner_parent;
-	scanner->buffer = buffer_new(NULL, 32768);
 
-	scanner->ent.name = duc_strdup(path);
-	scanner->ent.type = DUC_FILE_TYPE_DIR,
-	st_to_devino(st, &scanner->ent.devino);
-	st_to_size(st, &scanner->ent.size);
-	scanner->ent.size.apparent = 0;
-		
-	buffer_put_dir(scanner->buffer, &devino_parent, st->st_mtime);
+	return fsdev;
+}
 
-	duc_log(duc, DUC_LOG_DMP, ">> %s", scanner->ent.name);
 
-	return scanner;
+/*
+ * Check if the file system on this device should be scanned, depending on
+ * the fstypes_include and fstypes_exclude lists. If neither has any entries,
+ * all fs types are allowed. return 0 to skip, or 1 to scan
+ */
 
-err:
-	if(scanner->d) closedir(scanner->d);
-	if(scanner) free(scanner);
-	return NULL;
-}
+static int is_fstype_allowed(struct duc_index_req *req, duc_dev_t dev, const char *name)
+{
+	struct duc *duc = req->duc;
+	struct fsdev *fsdev;
+
+	if((req->fstypes_include == NULL) && (req->fstypes_exclude == NULL)) {
+		return 1;
+	}
 
+	pthread_mutex_lock(&req->mutex_fsdev);
+	HASH_FIND(hh, req->fsdevs, &dev, sizeof(dev), fsdev);
+	pthread_mutex_unlock(&req->mutex_fsdev);
 
-static void scanner_scan(struct scanner *scanner_dir)
-{
-        int r;
-        struct duc *duc = scanner_dir->duc;
-	struct duc_index_req *req = scanner_dir->req;
-	struct duc_index_report *report = scanner_dir->rep; 	
+	/* Devices not found in mountinfo are looked up by mount point, once */
 
-	report->dir_count ++;
-	duc_size_accum(&report->size, &scanner_dir->ent.size);
+	if(fsdev == NULL) {
+		char path_full[DUC_PATH_MAX];
+		char *res = realpath(name, path_full);
+		if (res == NULL) {
+		    report_skip(duc, name, "Cannot determine realpath result");
+		    return 0;
+		}
+		struct fstype *fstype = NULL;
+		HASH_FIND_STR(req->fstypes_mounted, path_full, fstype);
+		if(fstype == NULL) {
+			report_skip(duc, name, "Unable to determine fs type");
+			return 0;
+		}
 
-	r = chdir(scanner_dir->ent.name);
-	if(r != 0) {
-		report_skip(duc, scanner_dir->ent.name, strerror(errno));
-		return;
+		pthread_mutex_lock(&req->mutex_fsdev);
+		fsdev = fsdev_add(req, dev, fstype->type);
+		pthread_mutex_unlock(&req->mutex_fsdev);
 	}
 
-	/* Iterate directory entries */
+	if(fsdev->deny) {
+		report_skip(duc, name, fsdev->deny, fsdev->type);
+		return 0;
+	}
 
-	struct dirent *e;
-	while( (e = readdir(scanner_dir->d)) != NULL) {
+	return 1;
+}
 
-		/* Skip . and .. */
 
-		char *name = e->d_name;
+/* 
+ * Work queue handling. Push and pop operate on the tail of the worker's
+ * own queue, steal takes from the head of another worker's queue.
+ */
 
-		if(name[0] == '.') {
-			if(name[1] == '\0') continue;
-			if((name[1] == '.') && (name[2] == '\0')) continue;
-		}
+static void worker_push(struct worker *w, struct scanner *scanner)
+{
+	struct pool *pool = w->pool;
 
-		if(match_exclude(name, req->exclude_list)) {
-			report_skip(duc, name, "Excluded by user");
-			continue;
-		}
+	pthread_mutex_lock(&w->mutex);
+	if(w->queue_head == w->queue_tail) {
+		w->queue_head = w->queue_tail = 0;
+	}
+	if(w->queue_tail == w->queue_max) {
+		w->queue_max = w->queue_max ? w->queue_max * 2 : 64;
+		w->queue = duc_realloc(w->queue, w->queue_max * sizeof(*w->queue));
+	}
+	w->queue[w->queue_tail++] = scanner;
+	pthread_mutex_unlock(&w->mutex);
 
-		/* Get file info. Derive the file type from st.st_mode. It
-		 * seems that we cannot trust e->d_type because it is not
-		 * guaranteed to contain a sane value on all file system types.
-		 * See the readdir() man page for more details */
+	/* Wake up a sleeping worker to come and steal */
 
-		struct stat st_ent;
-		int r = lstat(name, &st_ent);
-		if(r == -1) {
-			duc_log(duc, DUC_LOG_WRN, "Error statting %s: %s", name, strerror(errno));
-			continue;
-		}
+	if(__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&pool->mutex);
+		pthread_cond_signal(&pool->cond_work);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
 
-		/* If this dirent lies on a different device, check the file system type of the new
-		 * device and skip if it is not on the list of approved types */
 
-		if(st_ent.st_dev != scanner_dir->ent.devino.dev) {
-			if(!is_fstype_allowed(req, name)) {
-				continue;
-			}
-		}
+static struct scanner *worker_pop(struct worker *w)
+{
+	struct scanner *scanner = NULL;
 
-		/* Are we looking for data for only a specific user? */
-		if(req->username) {
-		    if(st_ent.st_uid != req->uid) {
-			continue;
-		    }
-		}
-		
-		/* Create duc_dirent from readdir() and fstatat() results */
-		
-		struct duc_dirent ent;
-		ent.name = name;
-		ent.type = st_to_type(st_ent.st_mode);
-		st_to_devino(&st_ent, &ent.devino);
-		st_to_size(&st_ent, &ent.size);
+	pthread_mutex_lock(&w->mutex);
+	if(w->queue_tail > w->queue_head) {
+		scanner = w->queue[--w->queue_tail];
+	}
+	pthread_mutex_unlock(&w->mutex);
 
-		/* Skip hard link duplicates for any files with more then one hard link */
+	return scanner;
+}
 
-		if((ent.type != DUC_FILE_TYPE_DIR) && (req->flags & DUC_INDEX_CHECK_HARD_LINKS) &&
-		   (st_ent.st_nlink > 1) && is_duplicate(req, &ent.devino)) {
-			continue;
-		}
 
+static struct scanner *worker_steal(struct worker *w)
+{
+	struct pool *pool = w->pool;
+	int id = w - pool->worker_list;
+	int i;
 
-		/* Check if we can cross file system boundaries */
+	for(i=1; i<pool->worker_count; i++) {
+		struct worker *victim = &pool->worker_list[(id + i) % pool->worker_count];
+		struct scanner *scanner = NULL;
 
-		if((ent.type == DUC_FILE_TYPE_DIR) && (req->flags & DUC_INDEX_XDEV) &&
-		   (st_ent.st_dev != req->dev)) {
-			report_skip(duc, name, "Not crossing file system boundaries");
-			continue;
+		pthread_mutex_lock(&victim->mutex);
+		if(victim->queue_tail > victim->queue_head) {
+			scanner = victim->queue[victim->queue_head++];
 		}
+		pthread_mutex_unlock(&victim->mutex);
+
+		if(scanner) return scanner;
+	}
 
+	return NULL;
+}
 
-		/* Calculate size of this dirent */
-		
-		if(ent.type == DUC_FILE_TYPE_DIR) {
 
-			/* Open and scan child directory */
+/*
+ * Add the worker's totals for the last scanned directory to the report
+ */
 
-			struct scanner *scanner_ent = scanner_new(duc, scanner_dir, name, &st_ent);
-			if(scanner_ent == NULL)
-				continue;
+static void stats_flush(struct worker *w, struct duc_index_report *report)
+{
+	struct pool *pool = w->pool;
+	struct scanner_stats *stats = &w->stats;
+	int i;
+
+	pthread_mutex_lock(&pool->mutex_report);
+	report->file_count += stats->file_count;
+	report->dir_count += stats->dir_count;
+	duc_size_accum(&report->size, &stats->size);
+	for(i=0; i<=report->histogram_buckets && i<DUC_HISTOGRAM_BUCKETS_MAX; i++) {
+		report->histogram[i] += stats->histogram[i];
+		stats->histogram[i] = 0;
+	}
+	pthread_mutex_unlock(&pool->mutex_report);
 
-			scanner_scan(scanner_ent);
-			scanner_free(scanner_ent);
+	stats->file_count = 0;
+	stats->dir_count = 0;
+	memset(&stats->size, 0, sizeof(stats->size));
+}
 
-		} else {
 
-			duc_size_accum(&scanner_dir->ent.size, &ent.size);
-			duc_size_accum(&report->size, &ent.size);
+static void report_progress(struct duc_index_req *req, struct duc_index_report *report)
+{
+	pthread_mutex_lock(&req->pool->mutex_report);
+	req->progress_fn(report, req->progress_fndata);
+	pthread_mutex_unlock(&req->pool->mutex_report);
+}
 
-			report->file_count ++;
-			
-			/* add to histogram, trapping zero size files first. */
-			int i;
-			if (st_ent.st_size == 0) {
-			    i = 0;
-			} else {
-			    // Doesn't dynamically scale for different bucket counts.
-			    i = (int) floor(log(st_ent.st_size) / log(2));
-			}
 
-			/* clamp size of histogram even if we run into monster sized file */
-			if (i >= report->histogram_buckets) {
-			    i = report->histogram_buckets;
-			    duc_log(duc, DUC_LOG_WRN, "File sizes large enough we ran out of histogram buckets %d, please increase the number of buckets and re-run your indexing.",report->histogram_buckets);
-			}
-			report->histogram[i]++;
-
-			duc_log(duc, DUC_LOG_DMP, "  %c %jd %jd %s", 
-					duc_file_type_char(ent.type), ent.size.apparent, ent.size.actual, name);
-
-			/* optionally track largest N files */
-			if (req->flags & DUC_INDEX_TOPN_FILES) { 
-			    //printf(" is (%ld > %ld) && (%ld > %ld)\n",st_ent.st_size,report->topn_min_size, st_ent.st_size, report->topn_array[0]->size);
-			    if ((st_ent.st_size > report->topn_min_size) && (st_ent.st_size > report->topn_array[0]->size)) {
-				char path_full[DUC_PATH_MAX];
-				char *res = realpath(name, path_full);
-				if (res == NULL) {
-				    report_skip(duc, name, "Cannot determine realpath result");
-				    // FIXME
-				    path_full[0] ='\0';
-				}
+/*
+ * Take all queued records. Must be called with pool->mutex held
+ */
 
-				report->topn_array[0]->size = st_ent.st_size;
-				strncpy(report->topn_array[0]->name,path_full,sizeof(path_full));
-				qsort(report->topn_array, req->topn_cnt, sizeof(struct duc_topn_file *), topn_comp);
-			    }
-			}
-			
-			/* Optionally hide file names */
+static struct record *records_take(struct pool *pool)
+{
+	struct record *rec = pool->record_head;
 
-			if(req->flags & DUC_INDEX_HIDE_FILE_NAMES) ent.name = "<FILE>";
-		
+	pool->record_head = pool->record_tail = NULL;
+	pool->record_bytes = 0;
+	pool->record_count = 0;
+	pthread_cond_broadcast(&pool->cond_space);
+
+	return rec;
+}
 
-			/* Store record */
 
-			if((req->maxdepth == 0) || (scanner_dir->depth < req->maxdepth)) {
-				buffer_put_dirent(scanner_dir->buffer, &ent);
-			}
+/*
+ * Write a list of records to the database in one batch and free them
+ */
 
+static void records_write(struct pool *pool, struct record *rec)
+{
+	struct duc *duc = pool->req->duc;
+	struct record *r, *next;
+	size_t count = 0;
+
+	for(r=rec; r; r=r->next) {
+		if(count == pool->db_list_max) {
+			pool->db_list_max = pool->db_list_max ? pool->db_list_max * 2 : 256;
+			pool->db_list = duc_realloc(pool->db_list, pool->db_list_max * sizeof(*pool->db_list));
 		}
+		struct db_record *d = &pool->db_list[count++];
+		d->key = r->key;
+		d->key_len = r->keyl;
+		d->val = r->buffer->data;
+		d->val_len = r->buffer->len;
 	}
 
-	r = chdir("..");
-	if(r != 0) {
-		report_skip(duc, scanner_dir->ent.name, strerror(errno));
-		return;
+	if(count > 0) {
+		pthread_mutex_lock(&pool->mutex_db);
+		duc_errno e = db_put_batch(duc->db, pool->db_list, count);
+		pthread_mutex_unlock(&pool->mutex_db);
+		if(e != DUC_OK) duc->err = e;
 	}
 
+	for(r=rec; r; r=next) {
+		next = r->next;
+		buffer_free(r->buffer);
+		duc_free(r);
+	}
 }
 
 
-static void scanner_free(struct scanner *scanner)
-{
-	struct duc *duc = scanner->duc;
-	struct duc_index_req *req = scanner->req;
-	struct duc_index_report *report = scanner->rep; 	
-	
-	duc_log(duc, DUC_LOG_DMP, "<< %s actual:%jd apparent:%jd", 
-			scanner->ent.name, scanner->ent.size.apparent, scanner->ent.size.actual);
-
-	if(scanner->parent) {
-		duc_size_accum(&scanner->parent->ent.size, &scanner->ent.size);
+/*
+ * Queue a serialized record for the database. When running threaded the
+ * main thread does all the database writes, otherwise the queue is written
+ * out whenever a batch is full. The time spent waiting for the writer to
+ * make room is accounted in write_stall.
+ */
 
-		if((req->maxdepth == 0) || (scanner->depth < req->maxdepth)) {
-			buffer_put_dirent(scanner->parent->buffer, &scanner->ent);
+static void record_put_key(struct pool *pool, const char *key, size_t keyl, struct buffer *buffer)
+{
+	struct record *rec = duc_malloc(sizeof(*rec) + keyl);
+	struct record *batch = NULL;
+
+	memcpy(rec->key, key, keyl);
+	rec->keyl = keyl;
+	rec->buffer = buffer;
+	rec->next = NULL;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	if(pool->threaded && pool->record_bytes >= RECORD_QUEUE_BYTES) {
+		struct timeval t1, t2, dt;
+		gettimeofday(&t1, NULL);
+		pool->record_waiting ++;
+		while(pool->record_bytes >= RECORD_QUEUE_BYTES) {
+			pthread_cond_signal(&pool->cond_write);
+			pthread_cond_wait(&pool->cond_space, &pool->mutex);
 		}
-
+		pool->record_waiting --;
+		gettimeofday(&t2, NULL);
+		timersub(&t2, &t1, &dt);
+		timeradd(&pool->write_stall, &dt, &pool->write_stall);
 	}
-	
-	/* Progress reporting */
-
-	if(req->progress_fn) {
-
-		if((!scanner->parent) || (req->progress_n++ == 100)) {
-			
-			struct timeval t_now;
-			gettimeofday(&t_now, NULL);
-
-			if(!scanner->parent || timercmp(&t_now, &req->progress_time, > )) {
-				req->progress_fn(report, req->progress_fndata);
-				timeradd(&t_now, &req->progress_interval, &req->progress_time);
-			}
-			req->progress_n = 0;
-		}
 
+	if(pool->record_tail) {
+		pool->record_tail->next = rec;
+	} else {
+		pool->record_head = rec;
 	}
-	
-	if(!(req->flags & DUC_INDEX_DRY_RUN)) {
-		char key[32];
-		struct duc_devino *devino = &scanner->ent.devino;
-		size_t keyl = snprintf(key, sizeof(key), "%jx/%jx", (uintmax_t)devino->dev, (uintmax_t)devino->ino);
-		int r = db_put(duc->db, key, keyl, scanner->buffer->data, scanner->buffer->len);
-		if(r != 0) duc->err = r;
+	pool->record_tail = rec;
+	pool->record_bytes += buffer->len;
+	pool->record_count ++;
+	if(pool->record_count > pool->record_peak) {
+		pool->record_peak = pool->record_count;
+	}
+	if(pool->record_bytes >= RECORD_BATCH_BYTES) {
+		if(pool->threaded) {
+			pthread_cond_signal(&pool->cond_write);
+		} else {
+			batch = records_take(pool);
+		}
 	}
+	pthread_mutex_unlock(&pool->mutex);
 
-	buffer_free(scanner->buffer);
-	closedir(scanner->d);
-	duc_free(scanner->ent.name);
-	duc_free(scanner);
+	if(batch) records_write(pool, batch);
 }
 
 
-static void read_mounts(duc_index_req *req)
+/*
+ * Queue a record stored under the devino of the directory
+ */
+
+static void record_put(struct pool *pool, struct scanner *scanner, enum db_key_type type, struct buffer *buffer)
 {
-	FILE *f;
+	char key[DB_KEY_MAX];
+	size_t keyl = db_key_devino(scanner->duc, type, &scanner->ent.devino, key);
+
+	record_put_key(pool, key, keyl, buffer);
+}
+
+
+/*
+ * Queue the path index entry of the directory, used by duc_dir_open() to
+ * find it without walking down from the indexed root
+ */
+
+static void record_put_path(struct pool *pool, struct scanner *scanner)
+{
+	struct duc_index_req *req = scanner->req;
+	struct path_entry pe;
+	char key[DUC_PATH_MAX + 1];
+	size_t len = strlen(scanner->path);
+
+	/* A truncated path could be the key of another directory */
+
+	if(len > DUC_PATH_MAX || scanner->path_truncated) return;
+
+	pe.devino = scanner->ent.devino;
+	pe.stamp = req->stamp;
+	pe.root_len = req->root_len;
+
+	struct buffer *b = buffer_new(NULL, 32);
+	buffer_put_path_entry(b, &pe);
+	record_put_key(pool, key, db_key_path(scanner->path, len, key), b);
+}
+
+
+/*
+ * Create scanner for a directory. The directory itself is opened and read
+ * later by scanner_scan(), possibly on another thread.
+ */
+
+static struct scanner *scanner_new(struct duc *duc, struct scanner *scanner_parent, const char *name, const char *path, struct stat *st)
+{
+	struct scanner *scanner;
+	scanner = duc_malloc0(sizeof *scanner);
+
+	scanner->duc = duc;
+	scanner->parent = scanner_parent;
+	scanner->pending = 1;
+
+	if(scanner_parent) {
+		scanner->depth = scanner_parent->depth + 1;
+		scanner->req = scanner_parent->req;
+		scanner->rep = scanner_parent->rep;
+		scanner->devino_parent = scanner_parent->ent.devino;
+
+		/* See scanner_path() */
+
+		size_t len = strlen(scanner_parent->path);
+		if(len > 0 && scanner_parent->path[len-1] == '/') len --;
+		scanner->path_truncated = scanner_parent->path_truncated ||
+			(len + 1 + strlen(name) >= DUC_PATH_MAX);
+	}
+	
+	scanner->path = duc_strdup(path);
+	scanner->unopened = 1;
+	scanner->uid = st->st_uid;
+	scanner->nlink = st->st_nlink;
+	scanner->mtime = st->st_mtime;
+	
+	scanner->ent.name = duc_strdup(name);
+	scanner->ent.type = DUC_FILE_TYPE_DIR,
+	st_to_devino(st, &scanner->ent.devino);
+	st_to_size(st, &scanner->ent.size);
+	scanner->ent.size.apparent = 0;
+		
+	return scanner;
+}
+
+
+static void scanner_add(struct scanner *scanner, const struct duc_dirent *ent, struct scanner *child)
+{
+	if(scanner->ent_count == scanner->ent_max) {
+		scanner->ent_max = scanner->ent_max ? scanner->ent_max * 2 : 32;
+		scanner->ent_list = duc_realloc(scanner->ent_list, scanner->ent_max * sizeof(*scanner->ent_list));
+	}
+
+	struct scanner_ent *se = &scanner->ent_list[scanner->ent_count++];
+
+	if(child) {
+		se->child = child;
+	} else {
+		se->child = NULL;
+		se->ent = *ent;
+		se->ent.name = duc_strdup(ent->name);
+	}
+}
+
+
+/*
+ * Histogram bucket of a file size: floor(log2(size)), with empty files
+ * in bucket 0
+ */
+
+static int histogram_bucket(off_t size)
+{
+	if(size <= 0) return 0;
+	return 63 - __builtin_clzll(size);
+}
+
+
+/*
+ * Add counts to the subtree histogram of a directory, allocated on first use
+ */
+
+static void histogram_merge(struct scanner *scanner, const size_t *histogram)
+{
+	int i;
+
+	if(scanner->histogram == NULL) {
+		scanner->histogram = duc_malloc0(DUC_DIR_HISTOGRAM_BUCKETS * sizeof(*scanner->histogram));
+	}
+	for(i=0; i<DUC_DIR_HISTOGRAM_BUCKETS; i++) {
+		scanner->histogram[i] += histogram[i];
+	}
+}
+
+
+/*
+ * All children of this directory are done: serialize the entries into a
+ * record and add our size to the parent.
+ */
+
+static void scanner_finish(struct worker *w, struct scanner *scanner)
+{
+	struct duc *duc = scanner->duc;
+	struct duc_index_req *req = scanner->req;
+	struct duc_index_report *report = scanner->rep;
+	size_t i;
+
+	if(scanner->skip) {
+		scanner_free_entries(scanner);
+		return;
+	}
+
+	const struct duc_dirent **ent_list = duc_malloc((scanner->ent_count + 1) * sizeof(*ent_list));
+	size_t ent_count = 0;
+
+	for(i=0; i<scanner->ent_count; i++) {
+		struct scanner_ent *se = &scanner->ent_list[i];
+		if(se->child) {
+			struct scanner *child = se->child;
+			if(!child->skip) {
+				duc_size_accum(&scanner->ent.size, &child->ent.size);
+				if(child->histogram) histogram_merge(scanner, child->histogram);
+				if((req->maxdepth == 0) || (child->depth < req->maxdepth)) {
+					ent_list[ent_count++] = &child->ent;
+				}
+			}
+		} else {
+			ent_list[ent_count++] = &se->ent;
+		}
+	}
+
+	struct buffer *buffer = buffer_new(NULL, 32768);
+	buffer_put_dir(buffer, &scanner->devino_parent, scanner->mtime, ent_list, ent_count);
+	duc_free(ent_list);
+
+	duc_log(duc, DUC_LOG_DMP, "<< %s actual:%jd apparent:%jd",
+			scanner->ent.name, scanner->ent.size.apparent, scanner->ent.size.actual);
+
+	/* Progress reporting, the threaded case is handled by the main thread */
+
+	if(req->progress_fn && !w->pool->threaded) {
+
+		if((!scanner->parent) || (req->progress_n++ == 100)) {
+
+			struct timeval t_now;
+			gettimeofday(&t_now, NULL);
+
+			if(!scanner->parent || timercmp(&t_now, &req->progress_time, > )) {
+				report_progress(req, report);
+				timeradd(&t_now, &req->progress_interval, &req->progress_time);
+			}
+			req->progress_n = 0;
+		}
+
+	}
+
+	if(!(req->flags & DUC_INDEX_DRY_RUN)) {
+		record_put(w->pool, scanner, DB_KEY_DIR, buffer);
+		if(req->flags & DUC_INDEX_DIR_HISTOGRAM) {
+			static const size_t empty[DUC_DIR_HISTOGRAM_BUCKETS];
+			struct buffer *b = buffer_new(NULL, 64);
+			buffer_put_histogram(b, scanner->histogram ? scanner->histogram : empty, DUC_DIR_HISTOGRAM_BUCKETS);
+			record_put(w->pool, scanner, DB_KEY_HISTOGRAM, b);
+		}
+		if(scanner->depth == 0 || (scanner->depth <= req->path_depth &&
+				(req->maxdepth == 0 || scanner->depth < req->maxdepth))) {
+			record_put_path(w->pool, scanner);
+		}
+	} else {
+		buffer_free(buffer);
+	}
+
+	/* Only our own dirent is needed from here on, for the parent */
+
+	scanner_free_entries(scanner);
+}
+
+
+/*
+ * Drop one reference to the scanner. The last one to leave finishes the
+ * directory and propagates up to the parent.
+ */
+
+static void scanner_done(struct worker *w, struct scanner *scanner)
+{
+	struct pool *pool = w->pool;
+
+	while(scanner && __sync_sub_and_fetch(&scanner->pending, 1) == 0) {
+
+		struct scanner *parent = scanner->parent;
+		scanner_finish(w, scanner);
+
+		if(parent == NULL) {
+			pthread_mutex_lock(&pool->mutex);
+			pool->done = 1;
+			pthread_cond_broadcast(&pool->cond_work);
+			pthread_cond_broadcast(&pool->cond_write);
+			pthread_mutex_unlock(&pool->mutex);
+		}
+
+		scanner = parent;
+	}
+}
+
+
+/*
+ * Full path of a directory entry, only used for messages and the topN list.
+ * All file system access is relative to the directory handle.
+ */
+
+static char *scanner_path(struct scanner *scanner, const char *name, char *buf, size_t buflen)
+{
+	size_t len = strlen(scanner->path);
+	if(len > 0 && scanner->path[len-1] == '/') len --;
+	snprintf(buf, buflen, "%.*s/%s", (int)len, scanner->path, name);
+	return buf;
+}
+
+
+/*
+ * The directory handle is needed until all children have been opened
+ * relative to it. The last one to leave closes it.
+ */
+
+static void scanner_release_dir(struct scanner *scanner)
+{
+	if(__sync_sub_and_fetch(&scanner->unopened, 1) == 0) {
+		scan_closedir(scanner->d);
+		scanner->d = NULL;
+		__sync_sub_and_fetch(&scanner->req->pool->dir_open, 1);
+	}
+}
+
+
+/*
+ * Open the directory of a scanner, relative to the parent's handle when it
+ * is kept open for us, by full path otherwise. Running out of file
+ * descriptors is not fatal: other workers close their directories as they
+ * finish, so retry for a while before giving up on the subtree.
+ */
+
+static struct scan_dir *scanner_opendir(struct scanner *scanner_dir)
+{
+	struct pool *pool = scanner_dir->req->pool;
+	struct scanner *parent = scanner_dir->parent;
+	struct scan_dir *d = NULL;
+	int tries = 0;
+	int e;
+
+	if(parent && !scanner_dir->by_path) {
+		for(;;) {
+			d = scan_opendir(parent->d, scanner_dir->ent.name, scanner_dir->path, scanner_dir->uid);
+			if(d || !scanner_dir->path_truncated) break;
+
+			/* A truncated path can not be opened, keep trying
+			 * relative to the parent */
+
+			if((errno != EMFILE && errno != ENFILE) || ++tries == 100) break;
+			usleep(10 * 1000);
+		}
+		e = errno;
+		scanner_release_dir(parent);
+		errno = e;
+		if(d == NULL && scanner_dir->path_truncated) return NULL;
+		if(d == NULL && errno != EMFILE && errno != ENFILE) return NULL;
+	}
+
+	while(d == NULL) {
+		d = scan_opendir(NULL, NULL, scanner_dir->path, scanner_dir->uid);
+		if(d) break;
+		if((errno != EMFILE && errno != ENFILE) || ++tries == 100) return NULL;
+		usleep(10 * 1000);
+	}
+
+	__sync_add_and_fetch(&pool->dir_open, 1);
+	return d;
+}
+
+
+/*
+ * Account a file (anything but a directory) in the totals, histogram and
+ * topN list, and add it to the directory record.
+ */
+
+static void scanner_add_file(struct worker *w, struct scanner *scanner_dir, struct duc_dirent *ent)
+{
+	struct duc *duc = scanner_dir->duc;
+	struct duc_index_req *req = scanner_dir->req;
+	struct duc_index_report *report = scanner_dir->rep;
+	struct scanner_stats *stats = &w->stats;
+	off_t size = ent->size.apparent;
+
+	duc_size_accum(&scanner_dir->ent.size, &ent->size);
+	duc_size_accum(&stats->size, &ent->size);
+
+	stats->file_count ++;
+	
+	/* add to histogram, zero size files go in the first bucket */
+	int i = histogram_bucket(size);
+
+	if(req->flags & DUC_INDEX_DIR_HISTOGRAM) {
+		if(scanner_dir->histogram == NULL) {
+			scanner_dir->histogram = duc_malloc0(DUC_DIR_HISTOGRAM_BUCKETS * sizeof(*scanner_dir->histogram));
+		}
+		scanner_dir->histogram[i] ++;
+	}
+
+	/* clamp size of histogram even if we run into monster sized file */
+	if (i >= report->histogram_buckets) {
+	    i = report->histogram_buckets;
+	    duc_log(duc, DUC_LOG_WRN, "File sizes large enough we ran out of histogram buckets %d, please increase the number of buckets and re-run your indexing.",report->histogram_buckets);
+	}
+	stats->histogram[i]++;
+
+	duc_log(duc, DUC_LOG_DMP, "  %c %jd %jd %s", 
+			duc_file_type_char(ent->type), ent->size.apparent, ent->size.actual, ent->name);
+
+	/* optionally track largest N files, in the worker's own list */
+	if ((req->flags & DUC_INDEX_TOPN_FILES) && (size > report->topn_min_size)) {
+	    topn_add(w->topn, size, scanner_dir->path, ent->name);
+	}
+	
+	/* Optionally hide file names */
+
+	if(req->flags & DUC_INDEX_HIDE_FILE_NAMES) ent->name = "<FILE>";
+
+
+	/* Store record */
+
+	if((req->maxdepth == 0) || (scanner_dir->depth < req->maxdepth)) {
+		scanner_add(scanner_dir, ent, NULL);
+	}
+}
+
+
+/*
+ * Handle a stat'ed directory entry: apply the filters, queue directories
+ * for scanning and add everything else as a file.
+ */
+
+static void scanner_add_ent(struct worker *w, struct scanner *scanner_dir, struct scan_ent *se)
+{
+	struct duc *duc = scanner_dir->duc;
+	struct duc_index_req *req = scanner_dir->req;
+	const char *name = se->name;
+	char path[DUC_PATH_MAX];
+
+	if(se->err) {
+		duc_log(duc, DUC_LOG_WRN, "Error statting %s: %s",
+				scanner_path(scanner_dir, name, path, sizeof(path)), strerror(se->err));
+		return;
+	}
+
+	struct stat *st_ent = &se->st;
+
+	/* If this dirent lies on a different device, check the file system type of the new
+	 * device and skip if it is not on the list of approved types */
+
+	if(st_ent->st_dev != scanner_dir->ent.devino.dev) {
+		if(!is_fstype_allowed(req, st_ent->st_dev, scanner_path(scanner_dir, name, path, sizeof(path)))) {
+			return;
+		}
+	}
+
+	/* Are we looking for data for only a specific user? */
+	if(req->username) {
+	    if(st_ent->st_uid != req->uid) {
+		return;
+	    }
+	}
+	
+	/* Create duc_dirent from directory entry and stat results */
+	
+	struct duc_dirent ent;
+	ent.name = (char *)name;
+	ent.type = st_to_type(st_ent->st_mode);
+	st_to_devino(st_ent, &ent.devino);
+	st_to_size(st_ent, &ent.size);
+
+	/* Skip hard link duplicates for any files with more then one hard link */
+
+	if((ent.type != DUC_FILE_TYPE_DIR) && (req->flags & DUC_INDEX_CHECK_HARD_LINKS) &&
+	   (st_ent->st_nlink > 1) && is_duplicate(req, &ent.devino)) {
+		return;
+	}
+
+
+	/* Check if we can cross file system boundaries */
+
+	if((ent.type == DUC_FILE_TYPE_DIR) && (req->flags & DUC_INDEX_XDEV) &&
+	   (st_ent->st_dev != req->dev)) {
+		report_skip(duc, scanner_path(scanner_dir, name, path, sizeof(path)), "Not crossing file system boundaries");
+		return;
+	}
+
+
+	/* Calculate size of this dirent */
+	
+	if(ent.type == DUC_FILE_TYPE_DIR) {
+
+		/* Queue child directory for scanning. The parent keeps
+		 * a slot for it so the record order matches readdir() */
+
+		scanner_path(scanner_dir, name, path, sizeof(path));
+		struct scanner *scanner_ent = scanner_new(duc, scanner_dir, name, path, st_ent);
+		scanner_add(scanner_dir, NULL, scanner_ent);
+		__sync_add_and_fetch(&scanner_dir->pending, 1);
+
+		/* Keep our handle open for the child to open relative to,
+		 * unless too many are open already. The count is only a
+		 * hint, a few handles over the limit do no harm */
+
+		if(w->pool->dir_open < w->pool->dir_max || scanner_ent->path_truncated) {
+			__sync_add_and_fetch(&scanner_dir->unopened, 1);
+		} else {
+			scanner_ent->by_path = 1;
+		}
+		worker_push(w, scanner_ent);
+
+	} else {
+
+		scanner_add_file(w, scanner_dir, &ent);
+
+	}
+}
+
+
+/*
+ * Incremental indexing: when the mtime of the directory matches the stored
+ * record, no entries were added, removed or renamed since the last run and
+ * the stored file entries are reused without reading the directory. The
+ * subdirectories are still stat'ed and scanned, since their contents can
+ * change without touching our mtime. Returns 0 if the directory needs to
+ * be read.
+ */
+
+static int scanner_reuse(struct worker *w, struct scanner *scanner_dir)
+{
+	struct duc *duc = scanner_dir->duc;
+	struct duc_index_req *req = scanner_dir->req;
+	struct duc_devino *devino = &scanner_dir->ent.devino;
+	struct dir_header h;
+	size_t i;
+
+	/* The record must hold all entries, and the directory must not have
+	 * changed in the same second the previous index started */
+
+	if((req->maxdepth > 0) && (scanner_dir->depth + 1 >= req->maxdepth)) return 0;
+	if(scanner_dir->mtime >= req->incremental_since) return 0;
+
+	char key[DB_KEY_MAX];
+	size_t keyl = db_key_devino(duc, DB_KEY_DIR, devino, key);
+	size_t vall;
+
+	pthread_mutex_lock(&w->pool->mutex_db);
+	char *val = db_get(duc->db, key, keyl, &vall);
+	pthread_mutex_unlock(&w->pool->mutex_db);
+	if(val == NULL) return 0;
+
+	struct buffer *b = buffer_new(val, vall);
+	buffer_get_dir(b, &h, 0);
+	if(h.mtime != scanner_dir->mtime) {
+		buffer_free(b);
+		return 0;
+	}
+
+	struct duc_dirent *ent_list = buffer_get_dirents(b, &h, NULL);
+	size_t ent_count = h.count;
+	size_t dir_count = 0;
+	buffer_free(b);
+
+	for(i=0; i<ent_count; i++) {
+		if(ent_list[i].type == DUC_FILE_TYPE_DIR) dir_count ++;
+	}
+
+	/* On most file systems the link count of a directory is 2 plus the
+	 * number of subdirectories. If it does not match, some were skipped
+	 * last time and the directory is read again */
+
+	int reuse = (scanner_dir->nlink <= 1) || (scanner_dir->nlink == dir_count + 2);
+
+	if(reuse) {
+
+		duc_log(duc, DUC_LOG_DMP, "Reusing record of %s", scanner_dir->path);
+
+		struct scan_batch *batch = w->batch;
+		batch->ent_count = 0;
+		for(i=0; i<ent_count; i++) {
+			if(ent_list[i].type == DUC_FILE_TYPE_DIR) {
+				scan_batch_add(batch, ent_list[i].name, 1);
+			}
+		}
+		scan_stat(scanner_dir->d, batch, req->username ? SCAN_STAT_UID : 0);
+
+		size_t j = 0;
+		for(i=0; i<ent_count; i++) {
+			if(ent_list[i].type == DUC_FILE_TYPE_DIR) {
+				scanner_add_ent(w, scanner_dir, &batch->ent_list[j++]);
+			} else {
+				struct duc_dirent ent = ent_list[i];
+				scanner_add_file(w, scanner_dir, &ent);
+			}
+		}
+	}
+
+	duc_free(ent_list);
+
+	return reuse;
+}
+
+
+static void scanner_scan(struct worker *w, struct scanner *scanner_dir)
+{
+        struct duc *duc = scanner_dir->duc;
+	struct duc_index_req *req = scanner_dir->req;
+	struct duc_index_report *report = scanner_dir->rep; 	
+	struct scanner_stats *stats = &w->stats;
+
+	struct scanner *parent = scanner_dir->parent;
+	struct scan_dir *d = scanner_opendir(scanner_dir);
+	if(d == NULL) {
+		report_skip(duc, scanner_dir->path, strerror(errno));
+		scanner_dir->skip = 1;
+		scanner_done(w, scanner_dir);
+		return;
+	}
+	scanner_dir->d = d;
+
+	/* Subdirectories inherit the parent's file system settings unless
+	 * they are on another device */
+
+	if(parent && scanner_dir->ent.devino.dev != parent->ent.devino.dev) {
+		scan_check_fs(d);
+	}
+
+	duc_log(duc, DUC_LOG_DMP, ">> %s", scanner_dir->ent.name);
+
+	stats->dir_count ++;
+	duc_size_accum(&stats->size, &scanner_dir->ent.size);
+
+	if(req->incremental_since && scanner_reuse(w, scanner_dir)) {
+		scanner_release_dir(scanner_dir);
+		stats_flush(w, report);
+		scanner_done(w, scanner_dir);
+		return;
+	}
+
+	/* Iterate directory entries. Names are read in batches, filtered,
+	 * and the remaining entries are stat'ed together */
+
+	struct scan_batch *batch = w->batch;
+	int stat_flags = req->username ? SCAN_STAT_UID : 0;
+	int n;
+
+	/* Path relative to the indexed directory, for anchored excludes */
+
+	const char *dir_rel = scanner_dir->path + req->root_len;
+	if(*dir_rel == '/') dir_rel ++;
+
+	while( (n = scan_read(d, batch)) > 0) {
+
+		size_t j;
+
+		for(j=0; j<batch->ent_count; j++) {
+
+			struct scan_ent *se = &batch->ent_list[j];
+			const char *name = se->name;
+
+			/* Skip . and .. */
+
+			if(name[0] == '.') {
+				if((name[1] == '\0') || ((name[1] == '.') && (name[2] == '\0'))) {
+					se->skip = 1;
+					continue;
+				}
+			}
+
+			if(req->exclude && exclude_set_match(req->exclude, name, dir_rel)) {
+				char path[DUC_PATH_MAX];
+				report_skip(duc, scanner_path(scanner_dir, name, path, sizeof(path)), "Excluded by user");
+				se->skip = 1;
+			}
+		}
+
+		/* Get file info. Derive the file type from st.st_mode. It
+		 * seems that we cannot trust d_type because it is not
+		 * guaranteed to contain a sane value on all file system types.
+		 * See the readdir() man page for more details */
+
+		scan_stat(d, batch, stat_flags);
+
+		for(j=0; j<batch->ent_count; j++) {
+			struct scan_ent *se = &batch->ent_list[j];
+			if(!se->skip) scanner_add_ent(w, scanner_dir, se);
+		}
+	}
+
+	if(n < 0) {
+		report_skip(duc, scanner_dir->path, strerror(errno));
+	}
+
+	scanner_release_dir(scanner_dir);
+
+	stats_flush(w, report);
+	scanner_done(w, scanner_dir);
+}
+
+
+static void scanner_free_entries(struct scanner *scanner)
+{
+	size_t i;
+
+	for(i=0; i<scanner->ent_count; i++) {
+		struct scanner_ent *se = &scanner->ent_list[i];
+		if(se->child) {
+			scanner_free(se->child);
+		} else {
+			duc_free(se->ent.name);
+		}
+	}
+
+	duc_free(scanner->ent_list);
+	scanner->ent_list = NULL;
+	scanner->ent_count = 0;
+	scanner->ent_max = 0;
+}
+
+
+static void scanner_free(struct scanner *scanner)
+{
+	scanner_free_entries(scanner);
+	duc_free(scanner->path);
+	duc_free(scanner->ent.name);
+	duc_free(scanner->histogram);
+	duc_free(scanner);
+}
+	
+
+/*
+ * Worker main loop: scan directories from our own queue, steal from the
+ * others when we run dry, and sleep when there is nothing left to steal.
+ */
+
+static void *worker_run(void *ptr)
+{
+	struct worker *w = ptr;
+	struct pool *pool = w->pool;
+
+	for(;;) {
+
+		struct scanner *scanner = worker_pop(w);
+		if(scanner == NULL) scanner = worker_steal(w);
+
+		if(scanner) {
+			scanner_scan(w, scanner);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+		__atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+		if(!pool->done) {
+			scanner = worker_steal(w);
+			if(scanner == NULL) {
+				pthread_cond_wait(&pool->cond_work, &pool->mutex);
+			}
+		}
+		__atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+		int done = pool->done;
+		pthread_mutex_unlock(&pool->mutex);
+
+		if(scanner) {
+			scanner_scan(w, scanner);
+		} else if(done) {
+			break;
+		}
+	}
+	
+	return NULL;
+}
+
+
+/*
+ * Main thread loop while the workers are running: write finished records
+ * to the database and call the progress callback.
+ */
+			
+static void pool_write_records(struct pool *pool, struct duc_index_report *report)
+{
+	struct duc_index_req *req = pool->req;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while(!pool->done || pool->record_head) {
+
+		/* Let records pile up to a full batch unless the scan is done
+		 * or scanners are waiting for room */
+
+		if(pool->record_head && (pool->done || pool->record_waiting || pool->record_bytes >= RECORD_BATCH_BYTES)) {
+			struct record *rec = records_take(pool);
+			pthread_mutex_unlock(&pool->mutex);
+			records_write(pool, rec);
+			pthread_mutex_lock(&pool->mutex);
+			continue;
+		}
+
+		if(req->progress_fn) {
+			struct timespec ts;
+			struct timeval t_now;
+			gettimeofday(&t_now, NULL);
+			if(timercmp(&t_now, &req->progress_time, > )) {
+				pthread_mutex_unlock(&pool->mutex);
+				report_progress(req, report);
+				pthread_mutex_lock(&pool->mutex);
+				timeradd(&t_now, &req->progress_interval, &req->progress_time);
+			}
+			ts.tv_sec = req->progress_time.tv_sec;
+			ts.tv_nsec = req->progress_time.tv_usec * 1000;
+			pthread_cond_timedwait(&pool->cond_write, &pool->mutex, &ts);
+		} else {
+			pthread_cond_wait(&pool->cond_write, &pool->mutex);
+		}
+	}
+	
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+
+/*
+ * Number of directory handles to keep open for children, half of the file
+ * descriptor limit leaves room for the database and io_uring.
+ */
+
+static int pool_dir_max(void)
+{
+	struct rlimit rl;
+	rlim_t max = 4096;
+
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+		if(rl.rlim_cur / 2 < max) max = rl.rlim_cur / 2;
+	}
+	if(max < 4) max = 4;
+
+	return max;
+}
+
+
+static void pool_run(struct duc_index_req *req, struct scanner *scanner)
+{
+	struct pool pool;
+	int batch_flags = (req->flags & DUC_INDEX_IO_URING) ? SCAN_BATCH_IO_URING : 0;
+	int i;
+
+	memset(&pool, 0, sizeof pool);
+	pool.req = req;
+	pool.dir_max = pool_dir_max();
+	pool.worker_count = req->thread_count;
+	pool.threaded = (req->thread_count > 1) || (req->flags & DUC_INDEX_WRITE_BEHIND);
+	pool.worker_list = duc_malloc0(pool.worker_count * sizeof(struct worker));
+	pthread_mutex_init(&pool.mutex, NULL);
+	pthread_mutex_init(&pool.mutex_report, NULL);
+	pthread_mutex_init(&pool.mutex_db, NULL);
+	pthread_cond_init(&pool.cond_work, NULL);
+	pthread_cond_init(&pool.cond_write, NULL);
+	pthread_cond_init(&pool.cond_space, NULL);
+
+	for(i=0; i<pool.worker_count; i++) {
+		pool.worker_list[i].pool = &pool;
+		pool.worker_list[i].batch = scan_batch_new(batch_flags);
+		pool.worker_list[i].topn = topn_new((req->flags & DUC_INDEX_TOPN_FILES) ? req->topn_cnt : 0);
+		pthread_mutex_init(&pool.worker_list[i].mutex, NULL);
+	}
+
+	if(batch_flags && !scan_batch_io_uring(pool.worker_list[0].batch)) {
+		duc_log(req->duc, DUC_LOG_WRN, "io_uring is not available, using synchronous stat");
+	}
+
+	req->pool = &pool;
+	worker_push(&pool.worker_list[0], scanner);
+
+	if(pool.threaded) {
+		for(i=0; i<pool.worker_count; i++) {
+			struct worker *w = &pool.worker_list[i];
+			int r = pthread_create(&w->thread, NULL, worker_run, w);
+			if(r != 0) {
+				duc_log(req->duc, DUC_LOG_FTL, "Error creating thread: %s", strerror(r));
+				exit(1);
+			}
+		}
+		pool_write_records(&pool, scanner->rep);
+		for(i=0; i<pool.worker_count; i++) {
+			pthread_join(pool.worker_list[i].thread, NULL);
+		}
+		if(req->progress_fn) {
+			report_progress(req, scanner->rep);
+		}
+	} else {
+		worker_run(&pool.worker_list[0]);
+		records_write(&pool, records_take(&pool));
+	}
+
+	req->pool = NULL;
+
+	scanner->rep->write_queue_peak = pool.record_peak;
+	scanner->rep->write_stall = pool.write_stall;
+
+	for(i=0; i<pool.worker_count; i++) {
+		topn_merge(req->topn, pool.worker_list[i].topn);
+		topn_free(pool.worker_list[i].topn);
+		pthread_mutex_destroy(&pool.worker_list[i].mutex);
+		duc_free(pool.worker_list[i].queue);
+		scan_batch_free(pool.worker_list[i].batch);
+	}
+	duc_free(pool.worker_list);
+	duc_free(pool.db_list);
+	pthread_cond_destroy(&pool.cond_work);
+	pthread_cond_destroy(&pool.cond_write);
+	pthread_cond_destroy(&pool.cond_space);
+	pthread_mutex_destroy(&pool.mutex_db);
+	pthread_mutex_destroy(&pool.mutex_report);
+	pthread_mutex_destroy(&pool.mutex);
+}
+
+
+static void read_mounts(duc_index_req *req)
+{
+	FILE *f;
+	char buf[DUC_PATH_MAX];
+
+#ifdef HAVE_SYS_SYSMACROS_H
+
+	/* mountinfo lists the device number of every mount, so file system
+	 * types can be found by device without resolving any paths */
+
+	f = fopen("/proc/self/mountinfo", "r");
+
+	if(f) {
+		while(fgets(buf, sizeof(buf), f) != NULL) {
+			unsigned int major, minor;
+			char *sep = strstr(buf, " - ");
+			if(sep && sscanf(buf, "%*d %*d %u:%u", &major, &minor) == 2) {
+				char *type = strtok(sep + 3, " ");
+				if(type) fsdev_add(req, makedev(major, minor), type);
+			}
+		}
+		fclose(f);
+	}
+#endif
+
+	/* The mount table by path is the fallback for devices which are not
+	 * in mountinfo, or systems without it */
 
 	f = fopen("/proc/mounts", "r");
 
@@ -678,9 +1703,9 @@ static void read_mounts(duc_index_req *req)
 
 	if(f == NULL) {
 		duc_log(req->duc, DUC_LOG_FTL, "Unable to get list of mounted file systems");
+		return;
 	}
 
-	char buf[DUC_PATH_MAX];
 
 	while(fgets(buf, sizeof(buf)-1, f) != NULL) {
 		(void)strtok(buf, " ");
@@ -704,6 +1729,10 @@ struct duc_index_report *duc_index(duc_index_req *req, const char *path, duc_ind
 
 	req->flags = flags;
 
+	/* Directories cached from the database are about to be replaced */
+
+	dircache_flush(duc->dircache);
+
 	/* Canonicalize index path */
 
 	char *path_canon = duc_canonicalize_path(path);
@@ -719,18 +1748,18 @@ struct duc_index_report *duc_index(duc_index_req *req, const char *path, duc_ind
 	
 	struct duc_index_report *report = duc_malloc0(sizeof(struct duc_index_report));
 
-	for (int i = 0; i < req->topn_cnt; i++) {
-	    report->topn_array[i] = duc_malloc0(sizeof(duc_topn_file));
-	}
+	report->topn_array = duc_malloc0(req->topn_cnt * sizeof(duc_topn_file));
 	report->topn_min_size = DUC_TOPN_MIN_FILE_SIZE;
 	report->topn_cnt_max = DUC_TOPN_CNT_MAX;
 	report->topn_cnt = req->topn_cnt;
 
 	report->histogram_buckets = req->histogram_buckets;
-
+	report->options_hash = options_hash(req, flags);
 
 	gettimeofday(&report->time_start, NULL);
 	snprintf(report->path, sizeof(report->path), "%s", path_canon);
+	req->root_len = strlen(path_canon);
+	req->stamp = report->time_start.tv_sec * 1000000ULL + report->time_start.tv_usec;
 
 	/* Read mounted file systems to find fs types */
 
@@ -738,22 +1767,65 @@ struct duc_index_report *duc_index(duc_index_req *req, const char *path, duc_ind
 		read_mounts(req);
 	}
 
+	/* For incremental indexing, records of directories which did not change
+	 * since the start of the previous run can be reused, as long as the
+	 * same files were selected */
+
+	req->incremental_since = 0;
+
+	if(flags & DUC_INDEX_INCREMENTAL) {
+		if(flags & DUC_INDEX_CHECK_HARD_LINKS) {
+			duc_log(duc, DUC_LOG_WRN, "Incremental indexing is not supported when checking hard links");
+		} else {
+			struct duc_report *prev = db_read_report(duc, path_canon);
+			if(prev) {
+				if(prev->options_hash == report->options_hash) {
+					req->incremental_since = prev->info.time_start.tv_sec;
+				} else {
+					duc_log(duc, DUC_LOG_WRN, "Index options changed since the previous run, not reusing records");
+				}
+				duc_report_close(prev);
+			}
+			duc->err = DUC_OK;
+		}
+	}
+
+	req->topn = topn_new((flags & DUC_INDEX_TOPN_FILES) ? req->topn_cnt : 0);
+
+	if((flags & DUC_INDEX_CHECK_HARD_LINKS) && req->hard_links == NULL) {
+		req->hard_links = hardlink_table_new();
+	}
+
 	/* Recursively index subdirectories */
 
-	struct scanner *scanner = scanner_new(duc, NULL, path_canon, NULL);
+	struct stat st;
+	int r = lstat(path_canon, &st);
 
-	if(scanner) {
+	if(r == 0) {
+		struct scanner *scanner = scanner_new(duc, NULL, path_canon, path_canon, &st);
 		scanner->req = req;
 		scanner->rep = report;
 	
 		req->dev = scanner->ent.devino.dev;
 		report->devino = scanner->ent.devino;
 
-		scanner_scan(scanner);
+		pool_run(req, scanner);
+		if(req->hard_links) {
+			report->hard_link_mem_peak = hardlink_table_mem_peak(req->hard_links);
+		}
+		if(scanner->skip) {
+			memset(&report->devino, 0, sizeof(report->devino));
+		}
 		gettimeofday(&report->time_stop, NULL);
 		scanner_free(scanner);
+	} else {
+		duc_log(duc, DUC_LOG_WRN, "Error statting %s: %s", path_canon, strerror(errno));
 	}
 	
+	topn_export(req->topn, report->topn_array, report->topn_cnt);
+	topn_free(req->topn);
+	req->topn = NULL;
+
 	/* Store report */
 
 	if(!(req->flags & DUC_INDEX_DRY_RUN)) {
@@ -770,6 +1842,14 @@ struct duc_index_report *duc_index(duc_index_req *req, const char *path, duc_ind
 
 int duc_index_report_free(struct duc_index_report *rep)
 {
+	int i;
+
+	if(rep->topn_array) {
+		for(i=0; i<rep->topn_cnt; i++) {
+			duc_free(rep->topn_array[i].name);
+		}
+		duc_free(rep->topn_array);
+	}
 	free(rep);
 	return 0;
 }
@@ -777,4 +1857,3 @@ int duc_index_report_free(struct duc_index_report *rep)
 /*
  * End
  */
-
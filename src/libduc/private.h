@@ -3,7 +3,10 @@
 
 #include "duc.h"
 
-#define DUC_DB_VERSION "17"
+#define DUC_DB_VERSION "19"
+
+/* Oldest version that can still be read */
+#define DUC_DB_VERSION_MIN 17
 
 #ifndef S_ISLNK
 #define S_ISLNK(v) 0
@@ -30,11 +33,27 @@
   } while (0)
 #endif
 
+#ifndef timersub
+# define timersub(a, b, result)				      \
+  do {							      \
+   (result)->tv_sec = (a)->tv_sec - (b)->tv_sec;	      \
+   (result)->tv_usec = (a)->tv_usec - (b)->tv_usec;	      \
+   if ((result)->tv_usec < 0)				      \
+     {							      \
+       --(result)->tv_sec;				      \
+       (result)->tv_usec += 1000000;			      \
+     }							      \
+  } while (0)
+#endif
+
 struct duc {
 	struct db *db;
+	int db_version;
 	duc_errno err;
 	duc_log_level log_level;
 	duc_log_callback log_callback;
+	struct dircache *dircache;
+	struct catalog *catalog;    /* Report catalog, read on first use */
 };
 
 void *duc_malloc(size_t s);
@@ -45,6 +64,7 @@ void duc_free(void *p);
 
 
 void duc_size_accum(struct duc_size *s1, const struct duc_size *s2);
+int duc_dirent_cmp_actual(const struct duc_dirent *ea, const struct duc_dirent *eb);
 char *duc_canonicalize_path(const char *dir);
 
 #endif
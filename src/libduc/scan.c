@@ -0,0 +1,696 @@
+
+/*
+ * Directory reading and stat'ing for the indexer.
+ *
+ * On Linux directories are read with getdents64() into a large buffer,
+ * and entries are stat'ed with statx(), asking only for the fields duc
+ * actually uses. On network file systems AT_STATX_DONT_SYNC allows the
+ * client to answer from its attribute cache instead of doing a round trip
+ * to the server for every file.
+ *
+ * When these are not available at build time, or the kernel returns ENOSYS
+ * at run time, readdir() and fstatat() are used instead.
+ *
+ * Optionally the statx() calls for a batch are submitted through an
+ * io_uring, so many requests are in flight at once on storage with high
+ * latency. The ring is owned by the batch, so each worker has its own.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_VFS_H
+#include <sys/vfs.h>
+#endif
+#ifdef HAVE_STATX
+#include <sys/sysmacros.h>
+#endif
+#if HAVE_DECL_SYS_GETDENTS64 || HAVE_DECL_SYS_IO_URING_SETUP
+#include <sys/syscall.h>
+#endif
+#if defined(HAVE_STATX) && HAVE_DECL_IORING_OP_STATX && HAVE_DECL_SYS_IO_URING_SETUP
+#define USE_IO_URING
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "duc.h"
+#include "private.h"
+#include "scan.h"
+
+#if defined(HAVE_OPENAT) && defined(HAVE_FDOPENDIR)
+#define USE_OPENAT
+#endif
+
+/* The readdir() fallback copies names into the batch buffer, which always
+ * fits SCAN_BATCH_MAX names of maximum length */
+
+#define SCAN_BUF_SIZE (256 * 1024)
+#define SCAN_BATCH_MAX (SCAN_BUF_SIZE / 256)
+
+struct scan_dir {
+	int fd;
+	DIR *d;                     /* Only used by the readdir() fallback */
+	int eof;
+	int dont_sync;
+#ifndef HAVE_FSTATAT
+	char *path;
+#endif
+};
+
+#if HAVE_DECL_SYS_GETDENTS64
+struct scan_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static int getdents_broken = 0;
+#endif
+
+#ifdef HAVE_STATX
+static int statx_broken = 0;
+#endif
+
+#ifdef USE_IO_URING
+struct scan_uring {
+	int fd;
+	unsigned entries;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	size_t sq_len;
+	void *cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+	struct statx *stx;          /* Result buffer per slot */
+	size_t *slot_ent;           /* Batch entry index per slot */
+	unsigned *slot_free;
+	unsigned slot_free_count;
+	unsigned pending;           /* Submitted requests not yet completed */
+};
+
+#define SCAN_URING_ENTRIES 256
+#define SCAN_URING_RETRIES 100
+
+static struct scan_uring *uring_new(void);
+static void uring_free(struct scan_uring *u);
+#endif
+
+
+/*
+ * Open the directory relative to the parent's handle. This saves the kernel
+ * from resolving the full path for every directory, and keeps working if
+ * a parent directory is renamed while we are scanning. O_NOATIME is only
+ * allowed for the owner of the directory or a privileged user; we ask for
+ * it when it is likely to be permitted and retry without it otherwise.
+ */
+
+struct scan_dir *scan_opendir(struct scan_dir *parent, const char *name, const char *path, uid_t owner)
+{
+	struct scan_dir *d = duc_malloc0(sizeof *d);
+	int e;
+
+#ifdef USE_OPENAT
+	int fd;
+	int flags = O_RDONLY | O_DIRECTORY;
+	int fd_parent = AT_FDCWD;
+
+	if(parent) {
+		fd_parent = parent->fd;
+		flags |= O_NOFOLLOW;
+	} else {
+		name = path;
+	}
+#ifdef O_CLOEXEC
+	flags |= O_CLOEXEC;
+#endif
+#ifdef O_NOATIME
+	uid_t euid = geteuid();
+	if(euid == 0 || euid == owner) {
+		fd = openat(fd_parent, name, flags | O_NOATIME);
+		if(fd == -1 && errno == EPERM) {
+			fd = openat(fd_parent, name, flags);
+		}
+	} else {
+		fd = openat(fd_parent, name, flags);
+	}
+#else
+	fd = openat(fd_parent, name, flags);
+#endif
+	if(fd == -1) goto err;
+	d->fd = fd;
+#else
+	d->d = opendir(path);
+	if(d->d == NULL) goto err;
+	d->fd = dirfd(d->d);
+#endif
+
+#ifndef HAVE_FSTATAT
+	d->path = duc_strdup(path);
+#endif
+
+	if(parent) {
+		d->dont_sync = parent->dont_sync;
+	} else {
+		scan_check_fs(d);
+	}
+
+	return d;
+
+err:
+	e = errno;
+	duc_free(d);
+	errno = e;
+	return NULL;
+}
+
+
+void scan_closedir(struct scan_dir *d)
+{
+	if(d->d) {
+		closedir(d->d);
+	} else {
+		close(d->fd);
+	}
+#ifndef HAVE_FSTATAT
+	duc_free(d->path);
+#endif
+	duc_free(d);
+}
+
+
+/*
+ * Check the file system type of the directory. Called for the root and when
+ * crossing into another device, subdirectories inherit the parent's setting.
+ */
+
+void scan_check_fs(struct scan_dir *d)
+{
+	d->dont_sync = 0;
+
+#if defined(HAVE_SYS_VFS_H) && defined(HAVE_STATX) && defined(AT_STATX_DONT_SYNC)
+	struct statfs sfs;
+	if(fstatfs(d->fd, &sfs) == 0) {
+		switch((uint32_t)sfs.f_type) {
+			case 0x00006969:        /* NFS */
+			case 0x00c36400:        /* Ceph */
+			case 0x0000517b:        /* SMB */
+			case 0xff534d42:        /* CIFS */
+			case 0xfe534d42:        /* SMB2 */
+			case 0x01021997:        /* 9P */
+				d->dont_sync = 1;
+				break;
+		}
+	}
+#endif
+}
+
+
+/*
+ * Create a batch. With SCAN_BATCH_IO_URING the batch tries to set up an
+ * io_uring for stat'ing, scan_batch_io_uring() tells if that succeeded.
+ */
+
+struct scan_batch *scan_batch_new(int flags)
+{
+	struct scan_batch *b = duc_malloc0(sizeof *b);
+	b->buf_max = SCAN_BUF_SIZE;
+	b->buf = duc_malloc(b->buf_max);
+#ifdef USE_IO_URING
+	if(flags & SCAN_BATCH_IO_URING) {
+		b->uring = uring_new();
+	}
+#endif
+	return b;
+}
+
+
+int scan_batch_io_uring(struct scan_batch *b)
+{
+	return b->uring != NULL;
+}
+
+
+void scan_batch_free(struct scan_batch *b)
+{
+#ifdef USE_IO_URING
+	if(b->uring) uring_free(b->uring);
+#endif
+	duc_free(b->ent_list);
+	duc_free(b->buf);
+	duc_free(b);
+}
+
+
+static struct scan_ent *batch_add(struct scan_batch *b)
+{
+	if(b->ent_count == b->ent_max) {
+		b->ent_max = b->ent_max ? b->ent_max * 2 : 256;
+		b->ent_list = duc_realloc(b->ent_list, b->ent_max * sizeof(*b->ent_list));
+	}
+	struct scan_ent *e = &b->ent_list[b->ent_count++];
+	e->skip = 0;
+	e->err = 0;
+	return e;
+}
+
+
+/*
+ * Add an entry by name, for stat'ing entries which are known without
+ * reading the directory
+ */
+
+struct scan_ent *scan_batch_add(struct scan_batch *b, const char *name, int maybe_dir)
+{
+	struct scan_ent *e = batch_add(b);
+	e->name = name;
+	e->maybe_dir = maybe_dir;
+	return e;
+}
+
+
+/*
+ * Read the next batch of directory entries. Returns the number of entries,
+ * 0 at the end of the directory, or -1 on error. The names are valid until
+ * the next call.
+ */
+
+int scan_read(struct scan_dir *d, struct scan_batch *b)
+{
+	b->ent_count = 0;
+
+	if(d->eof) return 0;
+
+#if HAVE_DECL_SYS_GETDENTS64
+	if(d->d == NULL && !getdents_broken) {
+		long n = syscall(SYS_getdents64, d->fd, b->buf, b->buf_max);
+		if(n > 0) {
+			long off = 0;
+			while(off < n) {
+				struct scan_dirent64 *de = (struct scan_dirent64 *)(b->buf + off);
+				struct scan_ent *e = batch_add(b);
+				e->name = de->d_name;
+				e->maybe_dir = (de->d_type == DT_DIR) || (de->d_type == DT_UNKNOWN);
+				off += de->d_reclen;
+			}
+			return b->ent_count;
+		}
+		if(n == 0) {
+			d->eof = 1;
+			return 0;
+		}
+		if(errno != ENOSYS) return -1;
+		getdents_broken = 1;
+	}
+#endif
+
+#ifdef USE_OPENAT
+	if(d->d == NULL) {
+		d->d = fdopendir(d->fd);
+		if(d->d == NULL) return -1;
+	}
+#endif
+
+	size_t len = 0;
+
+	while(b->ent_count < SCAN_BATCH_MAX) {
+		struct dirent *de = readdir(d->d);
+		if(de == NULL) {
+			d->eof = 1;
+			break;
+		}
+		size_t l = strlen(de->d_name) + 1;
+		struct scan_ent *e = batch_add(b);
+		memcpy(b->buf + len, de->d_name, l);
+		e->name = b->buf + len;
+#if defined(_DIRENT_HAVE_D_TYPE) && defined(DT_UNKNOWN)
+		e->maybe_dir = (de->d_type == DT_DIR) || (de->d_type == DT_UNKNOWN);
+#else
+		e->maybe_dir = 1;
+#endif
+		len += l;
+	}
+
+	return b->ent_count;
+}
+
+
+#ifdef HAVE_STATX
+static void statx_to_stat(struct statx *stx, struct stat *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->st_mode = stx->stx_mode;
+	st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	st->st_ino = stx->stx_ino;
+	st->st_nlink = stx->stx_nlink;
+	st->st_uid = stx->stx_uid;
+	st->st_size = stx->stx_size;
+	st->st_mtime = stx->stx_mtime.tv_sec;
+#ifdef HAVE_STRUCT_STAT_ST_BLOCKS
+	if(stx->stx_mask & STATX_BLOCKS) {
+		st->st_blocks = stx->stx_blocks;
+	} else {
+		st->st_blocks = (stx->stx_size + 511) / 512;
+	}
+#endif
+}
+#endif
+
+
+#ifdef USE_IO_URING
+
+/*
+ * Free the ring. If requests could not be drained the kernel may still
+ * write into the result buffers, so everything is left allocated.
+ */
+
+static void uring_free(struct scan_uring *u)
+{
+	if(u->pending > 0) return;
+	if(u->sqes) munmap(u->sqes, u->sqes_len);
+	if(u->cq_ptr && u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_len);
+	if(u->sq_ptr) munmap(u->sq_ptr, u->sq_len);
+	if(u->fd >= 0) close(u->fd);
+	duc_free(u->stx);
+	duc_free(u->slot_ent);
+	duc_free(u->slot_free);
+	duc_free(u);
+}
+
+
+/*
+ * Check if the kernel supports IORING_OP_STATX, which was added in 5.6
+ */
+
+static int uring_probe(struct scan_uring *u)
+{
+	size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = duc_malloc0(len);
+	int ok = 0;
+
+	if(syscall(SYS_io_uring_register, u->fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+		ok = (probe->last_op >= IORING_OP_STATX) &&
+		     (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+	}
+
+	duc_free(probe);
+	return ok;
+}
+
+
+/*
+ * Set up the ring. Returns NULL if io_uring is not available, for example
+ * on older kernels or when disabled by sysctl or seccomp.
+ */
+
+static struct scan_uring *uring_new(void)
+{
+	struct io_uring_params p;
+	struct scan_uring *u = duc_malloc0(sizeof *u);
+	unsigned i;
+
+	memset(&p, 0, sizeof(p));
+	u->fd = syscall(SYS_io_uring_setup, SCAN_URING_ENTRIES, &p);
+	if(u->fd < 0) goto err;
+	if(!uring_probe(u)) goto err;
+
+	u->entries = p.sq_entries;
+	u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(u->cq_len > u->sq_len) u->sq_len = u->cq_len;
+		u->cq_len = u->sq_len;
+	}
+#endif
+
+	u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if(u->sq_ptr == MAP_FAILED) {
+		u->sq_ptr = NULL;
+		goto err;
+	}
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ptr = u->sq_ptr;
+	} else
+#endif
+	{
+		u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if(u->cq_ptr == MAP_FAILED) {
+			u->cq_ptr = NULL;
+			goto err;
+		}
+	}
+
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if(u->sqes == MAP_FAILED) {
+		u->sqes = NULL;
+		goto err;
+	}
+
+	u->sq_head  = (unsigned *)((char *)u->sq_ptr + p.sq_off.head);
+	u->sq_tail  = (unsigned *)((char *)u->sq_ptr + p.sq_off.tail);
+	u->sq_mask  = (unsigned *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)((char *)u->sq_ptr + p.sq_off.array);
+	u->cq_head  = (unsigned *)((char *)u->cq_ptr + p.cq_off.head);
+	u->cq_tail  = (unsigned *)((char *)u->cq_ptr + p.cq_off.tail);
+	u->cq_mask  = (unsigned *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+	u->cqes     = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+
+	u->stx = duc_malloc(u->entries * sizeof(*u->stx));
+	u->slot_ent = duc_malloc(u->entries * sizeof(*u->slot_ent));
+	u->slot_free = duc_malloc(u->entries * sizeof(*u->slot_free));
+	for(i=0; i<u->entries; i++) u->slot_free[i] = i;
+	u->slot_free_count = u->entries;
+
+	return u;
+
+err:
+	uring_free(u);
+	return NULL;
+}
+
+
+static void uring_prep_statx(struct scan_uring *u, unsigned slot, int fd, const char *name, int flags, unsigned int mask)
+{
+	unsigned tail = *u->sq_tail;
+	unsigned idx = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)name;
+	sqe->len = mask;
+	sqe->off = (uintptr_t)&u->stx[slot];
+	sqe->statx_flags = flags;
+	sqe->user_data = slot;
+
+	u->sq_array[idx] = idx;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Move the completions to the batch entries, or just free their slots if
+ * b is NULL
+ */
+
+static void uring_reap(struct scan_uring *u, struct scan_batch *b)
+{
+	unsigned head = *u->cq_head;
+	unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+	while(head != tail) {
+		struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+		unsigned slot = cqe->user_data;
+		if(b) {
+			struct scan_ent *e = &b->ent_list[u->slot_ent[slot]];
+			if(cqe->res < 0) {
+				e->err = -cqe->res;
+			} else {
+				statx_to_stat(&u->stx[slot], &e->st);
+			}
+		}
+		u->slot_free[u->slot_free_count++] = slot;
+		u->pending --;
+		head ++;
+	}
+
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Wait until all submitted requests completed, so the kernel no longer
+ * uses the result buffers or the names of the batch
+ */
+
+static void uring_drain(struct scan_uring *u)
+{
+	int tries = 0;
+
+	while(u->pending > 0) {
+		int r = syscall(SYS_io_uring_enter, u->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if(r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) return;
+		if(r < 0 && ++tries == SCAN_URING_RETRIES) return;
+		uring_reap(u, NULL);
+	}
+}
+
+
+/*
+ * Stat all entries of the batch through the ring, keeping it as full as
+ * possible. Returns -1 if the ring failed, in which case the requests in
+ * flight are drained first and the caller redoes the whole batch
+ * synchronously; stat'ing twice is harmless.
+ */
+
+static int uring_stat(struct scan_uring *u, struct scan_dir *d, struct scan_batch *b,
+		int at_flags, unsigned int mask)
+{
+	size_t i = 0;
+	unsigned inflight = 0;
+	unsigned unsubmitted = 0;
+	int tries = 0;
+
+	while(i < b->ent_count || inflight > 0) {
+
+		/* Fill free slots with the next entries */
+
+		while(i < b->ent_count && u->slot_free_count > 0) {
+			struct scan_ent *e = &b->ent_list[i];
+			if(!e->skip) {
+				unsigned slot = u->slot_free[--u->slot_free_count];
+				unsigned int m = mask;
+				if(e->maybe_dir) m |= STATX_MTIME | STATX_UID;
+				u->slot_ent[slot] = i;
+				uring_prep_statx(u, slot, d->fd, e->name, at_flags, m);
+				inflight ++;
+				unsubmitted ++;
+			}
+			i ++;
+		}
+
+		if(inflight == 0) break;
+
+		/* Submit and wait for at least one completion. EBUSY and EAGAIN
+		 * mean the completion queue is full or the kernel is short on
+		 * resources; reap what is there and retry a limited number of
+		 * times before giving up on the ring */
+
+		int r = syscall(SYS_io_uring_enter, u->fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if(r < 0) {
+			int again = (errno == EINTR || errno == EAGAIN || errno == EBUSY);
+			if(!again || ++tries == SCAN_URING_RETRIES) {
+				uring_drain(u);
+				return -1;
+			}
+		} else {
+			unsubmitted -= r;
+			u->pending += r;
+			tries = 0;
+		}
+
+		/* Reap completions */
+
+		unsigned pending = u->pending;
+		uring_reap(u, b);
+		inflight -= pending - u->pending;
+	}
+
+	return 0;
+}
+
+#endif
+
+
+/*
+ * Stat all entries of the batch which are not marked skip. The result or
+ * the errno is stored in the entry.
+ */
+
+void scan_stat(struct scan_dir *d, struct scan_batch *b, int flags)
+{
+	size_t i = 0;
+
+#ifdef HAVE_STATX
+	if(!statx_broken) {
+
+		/* Only directories need mtime, and uid for O_NOATIME; files
+		 * only need uid when filtering by user */
+
+		unsigned int mask = STATX_TYPE | STATX_SIZE | STATX_BLOCKS | STATX_INO | STATX_NLINK;
+		int at_flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+
+		if(flags & SCAN_STAT_UID) mask |= STATX_UID;
+		if(d->dont_sync) at_flags |= AT_STATX_DONT_SYNC;
+
+#ifdef USE_IO_URING
+		if(b->uring) {
+			if(uring_stat(b->uring, d, b, at_flags, mask) == 0) return;
+			uring_free(b->uring);
+			b->uring = NULL;
+			for(i=0; i<b->ent_count; i++) b->ent_list[i].err = 0;
+			i = 0;
+		}
+#endif
+
+		for(; i<b->ent_count; i++) {
+			struct scan_ent *e = &b->ent_list[i];
+			if(e->skip) continue;
+			struct statx stx;
+			unsigned int m = mask;
+			if(e->maybe_dir) m |= STATX_MTIME | STATX_UID;
+			if(statx(d->fd, e->name, at_flags, m, &stx) == -1) {
+				if(errno == ENOSYS) {
+					statx_broken = 1;
+					break;
+				}
+				e->err = errno;
+				continue;
+			}
+			statx_to_stat(&stx, &e->st);
+		}
+	}
+#endif
+
+	for(; i<b->ent_count; i++) {
+		struct scan_ent *e = &b->ent_list[i];
+		if(e->skip) continue;
+#ifdef HAVE_FSTATAT
+		int r = fstatat(d->fd, e->name, &e->st, AT_SYMLINK_NOFOLLOW);
+#else
+		char path[DUC_PATH_MAX];
+		snprintf(path, sizeof(path), "%s/%s", d->path, e->name);
+		int r = lstat(path, &e->st);
+#endif
+		if(r == -1) e->err = errno;
+	}
+}
+
+/*
+ * End
+ */
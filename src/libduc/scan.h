@@ -0,0 +1,49 @@
+#ifndef scan_h
+#define scan_h
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/*
+ * Low level directory reading for the indexer. Entries are read and
+ * stat'ed in batches, so the backends can use large getdents64() buffers
+ * and only ask the file system for the fields duc needs.
+ */
+
+#define SCAN_STAT_UID  (1<<0)      /* st_uid is needed for all entries */
+
+#define SCAN_BATCH_IO_URING  (1<<0)  /* Use io_uring for stat'ing, if available */
+
+struct scan_dir;
+struct scan_uring;
+
+struct scan_ent {
+	const char *name;
+	int maybe_dir;              /* Entry type hint from the directory: dir or unknown */
+	int skip;                   /* Set by the caller to not stat this entry */
+	int err;                    /* errno of the stat call, 0 on success */
+	struct stat st;
+};
+
+struct scan_batch {
+	struct scan_ent *ent_list;
+	size_t ent_count;
+	size_t ent_max;
+	char *buf;
+	size_t buf_max;
+	struct scan_uring *uring;
+};
+
+struct scan_dir *scan_opendir(struct scan_dir *parent, const char *name, const char *path, uid_t owner);
+void scan_closedir(struct scan_dir *d);
+void scan_check_fs(struct scan_dir *d);
+
+struct scan_batch *scan_batch_new(int flags);
+int scan_batch_io_uring(struct scan_batch *b);
+struct scan_ent *scan_batch_add(struct scan_batch *b, const char *name, int maybe_dir);
+void scan_batch_free(struct scan_batch *b);
+
+int scan_read(struct scan_dir *d, struct scan_batch *b);
+void scan_stat(struct scan_dir *d, struct scan_batch *b, int flags);
+
+#endif
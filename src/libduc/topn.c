@@ -0,0 +1,227 @@
+
+/*
+ * Tracking of the N largest files found while indexing. The entries are
+ * kept in a min-heap with the smallest file at the root, so checking a
+ * candidate is a single compare and adding one is O(log N). File names are
+ * stored in a string arena which is compacted when names of evicted
+ * entries take up more than half of it.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "duc.h"
+#include "private.h"
+#include "topn.h"
+
+struct topn_ent {
+	size_t size;
+	size_t name;                /* Offset of the name in the arena */
+};
+
+struct topn {
+	struct topn_ent *heap;
+	size_t count;
+	size_t max;
+	char *arena;
+	size_t arena_len;
+	size_t arena_max;
+	size_t arena_dead;          /* Bytes used by names no longer in the heap */
+};
+
+
+struct topn *topn_new(size_t max)
+{
+	struct topn *t = duc_malloc0(sizeof *t);
+	t->max = max;
+	t->heap = duc_malloc(max * sizeof(*t->heap));
+	return t;
+}
+
+
+void topn_free(struct topn *t)
+{
+	duc_free(t->heap);
+	duc_free(t->arena);
+	duc_free(t);
+}
+
+
+/*
+ * Returns 1 if a file of this size would make it into the list
+ */
+
+int topn_wants(struct topn *t, size_t size)
+{
+	if(t->max == 0) return 0;
+	return (t->count < t->max) || (size > t->heap[0].size);
+}
+
+
+static void arena_compact(struct topn *t)
+{
+	size_t len = t->arena_len - t->arena_dead;
+	char *arena = duc_malloc(len);
+	size_t off = 0;
+	size_t i;
+
+	for(i=0; i<t->count; i++) {
+		size_t l = strlen(t->arena + t->heap[i].name) + 1;
+		memcpy(arena + off, t->arena + t->heap[i].name, l);
+		t->heap[i].name = off;
+		off += l;
+	}
+
+	duc_free(t->arena);
+	t->arena = arena;
+	t->arena_len = off;
+	t->arena_max = len;
+	t->arena_dead = 0;
+}
+
+
+/*
+ * Store dir/name in the arena, or just name if dir is NULL
+ */
+
+static size_t arena_add(struct topn *t, const char *dir, const char *name)
+{
+	size_t dirl = dir ? strlen(dir) : 0;
+	size_t namel = strlen(name);
+	if(dirl > 0 && dir[dirl-1] == '/') dirl --;
+
+	size_t l = dirl + namel + 1 + (dir ? 1 : 0);
+
+	if(t->arena_dead > t->arena_len / 2 && t->arena_dead > 65536) {
+		arena_compact(t);
+	}
+
+	if(t->arena_len + l > t->arena_max) {
+		while(t->arena_len + l > t->arena_max) {
+			t->arena_max = t->arena_max ? t->arena_max * 2 : 4096;
+		}
+		t->arena = duc_realloc(t->arena, t->arena_max);
+	}
+
+	size_t off = t->arena_len;
+	char *p = t->arena + off;
+	if(dir) {
+		memcpy(p, dir, dirl);
+		p[dirl] = '/';
+		p += dirl + 1;
+	}
+	memcpy(p, name, namel + 1);
+	t->arena_len += l;
+
+	return off;
+}
+
+
+static void sift_up(struct topn *t, size_t i)
+{
+	struct topn_ent e = t->heap[i];
+
+	while(i > 0) {
+		size_t parent = (i - 1) / 2;
+		if(t->heap[parent].size <= e.size) break;
+		t->heap[i] = t->heap[parent];
+		i = parent;
+	}
+	t->heap[i] = e;
+}
+
+
+static void sift_down(struct topn *t, size_t i)
+{
+	struct topn_ent e = t->heap[i];
+
+	for(;;) {
+		size_t c = i * 2 + 1;
+		if(c >= t->count) break;
+		if(c + 1 < t->count && t->heap[c+1].size < t->heap[c].size) c ++;
+		if(e.size <= t->heap[c].size) break;
+		t->heap[i] = t->heap[c];
+		i = c;
+	}
+	t->heap[i] = e;
+}
+
+
+/*
+ * Add the file dir/name, replacing the smallest entry when the list is full.
+ * With dir NULL, name is the full path.
+ */
+
+void topn_add(struct topn *t, size_t size, const char *dir, const char *name)
+{
+	if(!topn_wants(t, size)) return;
+
+	if(t->count < t->max) {
+		t->heap[t->count].size = size;
+		t->heap[t->count].name = arena_add(t, dir, name);
+		sift_up(t, t->count++);
+	} else {
+		t->arena_dead += strlen(t->arena + t->heap[0].name) + 1;
+		t->heap[0].size = size;
+		t->heap[0].name = arena_add(t, dir, name);
+		sift_down(t, 0);
+	}
+}
+
+
+/*
+ * Add all entries of another list, used to combine the per thread lists
+ */
+
+void topn_merge(struct topn *t, struct topn *from)
+{
+	size_t i;
+
+	for(i=0; i<from->count; i++) {
+		topn_add(t, from->heap[i].size, NULL, from->arena + from->heap[i].name);
+	}
+}
+
+
+/*
+ * Fill list with the entries sorted by ascending size, the largest file
+ * last. Unused slots at the start get an empty name and size 0. Returns
+ * the number of entries found.
+ */
+
+size_t topn_export(struct topn *t, duc_topn_file *list, size_t n)
+{
+	size_t found = t->count < n ? t->count : n;
+	size_t i;
+
+	for(i=0; i<n; i++) {
+		list[i].name = NULL;
+		list[i].size = 0;
+	}
+
+	/* Pop the smallest entries first, dropping any that do not fit */
+
+	i = n - found;
+	while(t->count > 0) {
+		struct topn_ent e = t->heap[0];
+		t->heap[0] = t->heap[--t->count];
+		if(t->count > 0) sift_down(t, 0);
+		if(t->count < found) {
+			list[i].name = duc_strdup(t->arena + e.name);
+			list[i].size = e.size;
+			i ++;
+		}
+	}
+
+	for(i=0; i<n - found; i++) {
+		list[i].name = duc_strdup("");
+	}
+
+	return found;
+}
+
+/*
+ * End
+ */
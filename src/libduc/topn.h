@@ -0,0 +1,15 @@
+#ifndef topn_h
+#define topn_h
+
+#include "duc.h"
+
+struct topn;
+
+struct topn *topn_new(size_t max);
+void topn_free(struct topn *t);
+int topn_wants(struct topn *t, size_t size);
+void topn_add(struct topn *t, size_t size, const char *dir, const char *name);
+void topn_merge(struct topn *t, struct topn *from);
+size_t topn_export(struct topn *t, duc_topn_file *list, size_t n);
+
+#endif
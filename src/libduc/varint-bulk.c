@@ -0,0 +1,223 @@
+
+/*
+ * Bulk decoding of the varints from varint.c, used for the size columns of
+ * directory records. Most of the values in these columns fit in a single
+ * byte, so the SIMD versions look for runs of bytes up to 240 and widen a
+ * whole run at once, falling back to GetVarint64() for the longer values.
+ * The best implementation for the CPU is picked on the first call.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(HAVE_IMMINTRIN_H) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VARINT_X86
+#include <immintrin.h>
+#endif
+
+#include "varint.h"
+
+
+/*
+ * Decode a single varint at z[pos], returns 0 if it does not fit in n bytes.
+ * The one and two byte forms are handled inline.
+ */
+
+static inline int get_one(const uint8_t *z, size_t n, size_t pos, uint64_t *v)
+{
+	size_t left = n - pos;
+
+	if(left >= 2 && z[pos] <= 248) {
+		if(z[pos] <= 240) {
+			*v = z[pos];
+			return 1;
+		}
+		*v = (z[pos] - 241) * 256 + z[pos+1] + 240;
+		return 2;
+	}
+
+	return GetVarint64(z + pos, left < 9 ? left : 9, v);
+}
+
+
+static size_t bulk_scalar(const uint8_t *z, size_t n, uint64_t *out, size_t count)
+{
+	size_t pos = 0;
+	size_t i;
+
+	for(i=0; i<count; i++) {
+		int l = get_one(z, n, pos, &out[i]);
+		if(l == 0) break;
+		pos += l;
+	}
+
+	for(; i<count; i++) out[i] = 0;
+
+	return pos;
+}
+
+
+#ifdef VARINT_X86
+
+__attribute__((target("sse2")))
+static size_t bulk_sse2(const uint8_t *z, size_t n, uint64_t *out, size_t count)
+{
+	const __m128i lim = _mm_set1_epi8((char)241);
+	const __m128i zero = _mm_setzero_si128();
+	size_t simd_from = 0;
+	size_t pos = 0;
+	size_t i = 0;
+
+	if(count < 16) return bulk_scalar(z, n, out, count);
+
+	while(i < count) {
+
+		if(n - pos >= 16 && count - i >= 16 && z[pos] <= 240 && i >= simd_from) {
+
+			/* Mask of the bytes starting a multi byte varint */
+
+			__m128i v = _mm_loadu_si128((const __m128i *)(z + pos));
+			int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, lim), v));
+			int run = mask ? __builtin_ctz(mask) : 16;
+
+			__m128i w[2] = { _mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero) };
+			int k;
+
+			for(k=0; k<2; k++) {
+				__m128i d0 = _mm_unpacklo_epi16(w[k], zero);
+				__m128i d1 = _mm_unpackhi_epi16(w[k], zero);
+				__m128i *o = (__m128i *)(out + i + k * 8);
+				_mm_storeu_si128(o + 0, _mm_unpacklo_epi32(d0, zero));
+				_mm_storeu_si128(o + 1, _mm_unpackhi_epi32(d0, zero));
+				_mm_storeu_si128(o + 2, _mm_unpacklo_epi32(d1, zero));
+				_mm_storeu_si128(o + 3, _mm_unpackhi_epi32(d1, zero));
+			}
+			pos += run;
+			i += run;
+			if(run == 16) continue;
+			if(run < 8) simd_from = i + 16;
+		}
+
+		int l = get_one(z, n, pos, &out[i]);
+		if(l == 0) break;
+		pos += l;
+		i ++;
+	}
+
+	for(; i<count; i++) out[i] = 0;
+
+	return pos;
+}
+
+
+__attribute__((target("avx2")))
+static size_t bulk_avx2(const uint8_t *z, size_t n, uint64_t *out, size_t count)
+{
+	const __m256i lim = _mm256_set1_epi8((char)241);
+	size_t simd_from = 0;
+	size_t pos = 0;
+	size_t i = 0;
+
+	if(count < 32) return bulk_scalar(z, n, out, count);
+
+	while(i < count) {
+
+		if(n - pos >= 32 && count - i >= 32 && z[pos] <= 240 && i >= simd_from) {
+
+			__m256i v = _mm256_loadu_si256((const __m256i *)(z + pos));
+			uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, lim), v));
+			int run = mask ? __builtin_ctz(mask) : 32;
+			int k;
+
+			for(k=0; k<run; k+=4) {
+				int32_t b4;
+				memcpy(&b4, z + pos + k, sizeof b4);
+				__m256i d = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(b4));
+				_mm256_storeu_si256((__m256i *)(out + i + k), d);
+			}
+			pos += run;
+			i += run;
+			if(run == 32) continue;
+			if(run < 8) simd_from = i + 32;
+		}
+
+		int l = get_one(z, n, pos, &out[i]);
+		if(l == 0) break;
+		pos += l;
+		i ++;
+	}
+
+	for(; i<count; i++) out[i] = 0;
+
+	return pos;
+}
+
+#endif
+
+
+static const struct varint_bulk impl_list[] = {
+	{ "scalar", bulk_scalar },
+#ifdef VARINT_X86
+	{ "sse2", bulk_sse2 },
+	{ "avx2", bulk_avx2 },
+#endif
+	{ NULL, NULL },
+};
+
+
+static int impl_supported(const struct varint_bulk *impl)
+{
+#ifdef VARINT_X86
+	__builtin_cpu_init();
+	if(impl->decode == bulk_sse2) return __builtin_cpu_supports("sse2");
+	if(impl->decode == bulk_avx2) return __builtin_cpu_supports("avx2");
+#endif
+	return 1;
+}
+
+
+/*
+ * Fill list with the implementations this CPU supports, slowest first.
+ * Returns the number of entries, list must have room for VARINT_BULK_MAX.
+ */
+
+int GetVarint64BulkList(struct varint_bulk *list)
+{
+	const struct varint_bulk *impl;
+	int n = 0;
+
+	for(impl=impl_list; impl->name; impl++) {
+		if(impl_supported(impl)) list[n++] = *impl;
+	}
+
+	return n;
+}
+
+
+/*
+ * Decode count varints from the n bytes at z into out. Values missing at
+ * the end of a truncated buffer are set to 0. Returns the number of bytes
+ * used.
+ */
+
+size_t GetVarint64Bulk(const uint8_t *z, size_t n, uint64_t *out, size_t count)
+{
+	static varint_bulk_fn best = NULL;
+	varint_bulk_fn fn = __atomic_load_n(&best, __ATOMIC_RELAXED);
+
+	if(fn == NULL) {
+		struct varint_bulk list[VARINT_BULK_MAX];
+		int l = GetVarint64BulkList(list);
+		fn = list[l-1].decode;
+		__atomic_store_n(&best, fn, __ATOMIC_RELAXED);
+	}
+
+	return fn(z, n, out, count);
+}
+
+/*
+ * End
+ */
+
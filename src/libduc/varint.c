@@ -105,6 +105,7 @@
 ** return 0;
 */
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "varint.h"
@@ -7,4 +7,16 @@ int GetVarint32(const uint8_t *z, uint32_t *pResult);
 int PutVarint32(uint8_t *p, uint32_t v);
 int VarintLen(uint64_t v);
 
+#define VARINT_BULK_MAX 4
+
+typedef size_t (*varint_bulk_fn)(const uint8_t *z, size_t n, uint64_t *out, size_t count);
+
+struct varint_bulk {
+	const char *name;
+	varint_bulk_fn decode;
+};
+
+size_t GetVarint64Bulk(const uint8_t *z, size_t n, uint64_t *out, size_t count);
+int GetVarint64BulkList(struct varint_bulk *list);
+
 #endif
@@ -179,6 +179,79 @@ else
 fi
 
 
+# Indexing with multiple threads must give the same result
+
+rm -rf $DUC_DATABASE
+$valgrind ./duc index --check-hard-links --threads 4 ${DUC_TEST_DIR} > ${DUC_TEST_DIR}.out 2>&1
+$valgrind ./duc ls -aR ${DUC_TEST_DIR} > ${DUC_TEST_DIR}.out 2>&1
+md5sum ${DUC_TEST_DIR}.out > /tmp/.duc.md5sum
+grep -q "$testsum0\|$testsum1\|$testsum2" /tmp/.duc.md5sum
+
+if [ "$?" = "0" ]; then
+	echo "threads: ok"
+else
+	echo "threads: failed"
+	cat /tmp/.duc.md5sum
+	exit 1
+fi
+
+
+# Incremental indexing must give the same result as a full index. Directory
+# mtimes are moved back so they are older than the previous run.
+
+find ${DUC_TEST_DIR} -type d -exec touch -d 2020-01-01 {} +
+rm -rf $DUC_DATABASE
+$valgrind ./duc index ${DUC_TEST_DIR} > ${DUC_TEST_DIR}.out 2>&1
+$valgrind ./duc ls -aR ${DUC_TEST_DIR} > ${DUC_TEST_DIR}.full 2>&1
+$valgrind ./duc index --debug --incremental ${DUC_TEST_DIR} > ${DUC_TEST_DIR}.out 2>&1
+grep -q "Reusing record" ${DUC_TEST_DIR}.out && \
+	$valgrind ./duc ls -aR ${DUC_TEST_DIR} > ${DUC_TEST_DIR}.out 2>&1 && \
+	cmp -s ${DUC_TEST_DIR}.full ${DUC_TEST_DIR}.out
+
+if [ "$?" = "0" ]; then
+	echo "incremental: ok"
+else
+	echo "incremental: failed"
+	diff ${DUC_TEST_DIR}.full ${DUC_TEST_DIR}.out
+	exit 1
+fi
+
+# Records written with other options are not reused: --max-depth leaves out
+# the deeper directories and --check-hard-links the other links
+
+for opt in "--max-depth 2" "--check-hard-links"; do
+	rm -rf $DUC_DATABASE
+	$valgrind ./duc index $opt ${DUC_TEST_DIR} > ${DUC_TEST_DIR}.out 2>&1
+	$valgrind ./duc index --incremental ${DUC_TEST_DIR} > ${DUC_TEST_DIR}.out 2>&1
+	$valgrind ./duc ls -aR ${DUC_TEST_DIR} > ${DUC_TEST_DIR}.out 2>&1
+
+	if cmp -s ${DUC_TEST_DIR}.full ${DUC_TEST_DIR}.out; then
+		echo "incremental $opt: ok"
+	else
+		echo "incremental $opt: failed"
+		diff ${DUC_TEST_DIR}.full ${DUC_TEST_DIR}.out
+		exit 1
+	fi
+done
+
+
+# The histogram stored for the top directory covers the same files as the
+# histogram in the index report.
+
+$valgrind ./duc index --dir-histogram ${DUC_TEST_DIR} > ${DUC_TEST_DIR}.out 2>&1
+$valgrind ./duc histogram | awk 'NF == 3 && $3 != 0' > ${DUC_TEST_DIR}.full 2>&1
+$valgrind ./duc histogram ${DUC_TEST_DIR} | awk 'NF == 3 && $3 != 0' > ${DUC_TEST_DIR}.out 2>&1
+grep -qv Bkt ${DUC_TEST_DIR}.out && cmp -s ${DUC_TEST_DIR}.full ${DUC_TEST_DIR}.out
+
+if [ "$?" = "0" ]; then
+	echo "histogram: ok"
+else
+	echo "histogram: failed"
+	diff ${DUC_TEST_DIR}.full ${DUC_TEST_DIR}.out
+	exit 1
+fi
+
+
 # Test backend checking.
 ductype=`./duc --version | tail -1 | awk '{print $NF}'`
 typemax=5
@@ -0,0 +1,72 @@
+#!/bin/sh
+
+# Benchmark the synchronous stat path against the io_uring engine of
+# 'duc index'. Creates a synthetic tree of DIRS directories with FILES
+# files each, and reports entries/sec for every mode and thread count.
+#
+# usage: testing/bench-scan.sh [-d DIRS] [-f FILES] [-t "THREADS..."] [-r RUNS] [-c] [PATH]
+#
+#   -c    drop the page cache before every run (needs root)
+#
+# When PATH is given, that tree is indexed instead of a synthetic one.
+
+DUC=${DUC:-./duc}
+DIRS=200
+FILES=200
+THREADS="1 4"
+RUNS=3
+COLD=0
+
+while getopts "d:f:t:r:c" opt; do
+	case $opt in
+		d) DIRS=$OPTARG ;;
+		f) FILES=$OPTARG ;;
+		t) THREADS=$OPTARG ;;
+		r) RUNS=$OPTARG ;;
+		c) COLD=1 ;;
+		*) sed -n '3,11p' $0; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ -n "$1" ]; then
+	TREE=$1
+else
+	TREE=$(mktemp -d /tmp/duc-bench-XXXXXX)
+	trap 'rm -rf "$TREE"' EXIT
+	echo "Creating $DIRS directories with $FILES files in $TREE"
+	d=0
+	while [ $d -lt $DIRS ]; do
+		mkdir -p "$TREE/d$((d % 10))/dir$d"
+		(cd "$TREE/d$((d % 10))/dir$d" && seq 1 $FILES | xargs touch)
+		d=$((d + 1))
+	done
+fi
+
+ENTRIES=$(find "$TREE" | wc -l)
+echo "Indexing $ENTRIES entries, best of $RUNS runs"
+echo
+
+now()
+{
+	date +%s.%N
+}
+
+for threads in $THREADS; do
+	for mode in sync io-uring; do
+		opts="--dry-run -q --threads $threads"
+		[ $mode = io-uring ] && opts="$opts --io-uring"
+		best=
+		run=0
+		while [ $run -lt $RUNS ]; do
+			[ $COLD = 1 ] && sync && echo 3 > /proc/sys/vm/drop_caches
+			t0=$(now)
+			$DUC index $opts "$TREE" || exit 1
+			t1=$(now)
+			best=$(awk -v a=$t0 -v b=$t1 -v best=$best 'BEGIN { t = b - a; if(best == "" || t < best) best = t; print best }')
+			run=$((run + 1))
+		done
+		awk -v n=$ENTRIES -v t=$best -v m=$mode -v th=$threads \
+			'BEGIN { printf("%-9s threads %2d: %8.3f s %12.0f entries/sec\n", m, th, t, n / t) }'
+	done
+done
@@ -0,0 +1,243 @@
+
+/*
+ * Time the bulk varint decoders on the size columns of the directory
+ * records in a database. Not built by default, use 'make testing/bench-varint'.
+ *
+ * usage: testing/bench-varint [-t SECONDS] DATABASE
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "duc.h"
+#include "private.h"
+#include "db.h"
+#include "buffer.h"
+#include "varint.h"
+
+static double opt_time = 1.0;
+
+struct column_set {
+	uint8_t *data;              /* Size columns of all records */
+	size_t len;
+	size_t max;
+	size_t *count;              /* Number of varints per record */
+	size_t *bytes;              /* Number of bytes per record */
+	size_t records;
+	size_t records_max;
+	size_t values;
+};
+
+
+static void column_add(struct column_set *cs, const uint8_t *data, size_t len, size_t count)
+{
+	if(cs->len + len > cs->max) {
+		while(cs->len + len > cs->max) cs->max = cs->max ? cs->max * 2 : 65536;
+		cs->data = duc_realloc(cs->data, cs->max);
+	}
+	if(cs->records == cs->records_max) {
+		cs->records_max = cs->records_max ? cs->records_max * 2 : 1024;
+		cs->count = duc_realloc(cs->count, cs->records_max * sizeof(*cs->count));
+		cs->bytes = duc_realloc(cs->bytes, cs->records_max * sizeof(*cs->bytes));
+	}
+	memcpy(cs->data + cs->len, data, len);
+	cs->len += len;
+	cs->count[cs->records] = count;
+	cs->bytes[cs->records] = len;
+	cs->records ++;
+	cs->values += count;
+}
+
+
+/*
+ * Collect the size columns of the record of devino and recurse into its
+ * subdirectories
+ */
+
+static void collect(duc *duc, struct column_set *cs, const struct duc_devino *devino)
+{
+	char key[DB_KEY_MAX];
+	size_t keyl = db_key_devino(duc, DB_KEY_DIR, devino, key);
+	size_t vall;
+	size_t i;
+
+	char *val = db_get(duc->db, key, keyl, &vall);
+	if(val == NULL) return;
+
+	struct buffer *b = buffer_new(val, vall);
+	struct dir_header h;
+	uint64_t names_len;
+
+	buffer_get_dir(b, &h, 0);
+	size_t start = b->ptr;
+	uint64_t *tmp = duc_malloc((h.count * 3 + 1) * sizeof(*tmp));
+
+	/* Skip the ranks, names and types */
+
+	if(h.flags & DIR_FLAG_RANK_ACTUAL) {
+		start += GetVarint64Bulk(b->data + start, b->len - start, tmp, h.count);
+	}
+	GetVarint64(b->data + start, b->len - start < 9 ? b->len - start : 9, &names_len);
+	start += VarintLen(names_len) + names_len + h.count;
+
+	if(h.count > 0 && start < b->len) {
+		size_t len = GetVarint64Bulk(b->data + start, b->len - start, tmp, h.count * 3);
+		column_add(cs, b->data + start, len, h.count * 3);
+	}
+	duc_free(tmp);
+
+	struct duc_dirent *ent_list = buffer_get_dirents(b, &h, NULL);
+	buffer_free(b);
+
+	for(i=0; i<h.count; i++) {
+		if(ent_list[i].type == DUC_FILE_TYPE_DIR) {
+			collect(duc, cs, &ent_list[i].devino);
+		}
+	}
+	duc_free(ent_list);
+}
+
+
+/*
+ * Reference decoder calling GetVarint64() for every value, as done before
+ * the bulk decoders existed
+ */
+
+static size_t decode_single(const uint8_t *z, size_t n, uint64_t *out, size_t count)
+{
+	size_t pos = 0;
+	size_t i;
+
+	for(i=0; i<count; i++) {
+		size_t left = n - pos;
+		int l = GetVarint64(z + pos, left < 9 ? left : 9, &out[i]);
+		if(l == 0) break;
+		pos += l;
+	}
+	for(; i<count; i++) out[i] = 0;
+
+	return pos;
+}
+
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1.0E6;
+}
+
+
+static int bench(duc *duc, const char *path_db)
+{
+	struct column_set cs;
+	const struct duc_report_info *info;
+	duc_catalog *cat;
+	int i;
+
+	memset(&cs, 0, sizeof(cs));
+
+	int r = duc_open(duc, path_db, DUC_OPEN_RO);
+	if(r != DUC_OK) {
+		fprintf(stderr, "%s: %s\n", path_db, duc_strerror(duc));
+		return 1;
+	}
+
+	if(duc->db_version < DB_VERSION_DIR_COLUMNS) {
+		fprintf(stderr, "%s: database has no columnar directory records, please reindex\n", path_db);
+		duc_close(duc);
+		return 1;
+	}
+
+	cat = duc_catalog_open(duc);
+	while((info = duc_catalog_read(cat)) != NULL) {
+		collect(duc, &cs, &info->devino);
+	}
+	duc_catalog_close(cat);
+
+	printf("%zu records, %zu values in %zu bytes\n", cs.records, cs.values, cs.len);
+
+	if(cs.values == 0) {
+		duc_close(duc);
+		return 0;
+	}
+
+	uint64_t *out = duc_malloc(cs.values * sizeof(*out));
+	struct varint_bulk list[VARINT_BULK_MAX + 1] = { { "single", decode_single } };
+	int n = GetVarint64BulkList(list + 1) + 1;
+	uint64_t sum_ref = 0;
+
+	for(i=0; i<n; i++) {
+
+		uint64_t sum = 0;
+		size_t rounds = 0;
+		double t1 = now(), t2;
+
+		do {
+			size_t j, pos = 0, o = 0;
+			for(j=0; j<cs.records; j++) {
+				list[i].decode(cs.data + pos, cs.bytes[j], out + o, cs.count[j]);
+				pos += cs.bytes[j];
+				o += cs.count[j];
+			}
+			rounds ++;
+			t2 = now();
+		} while(t2 - t1 < opt_time);
+
+		size_t j;
+		for(j=0; j<cs.values; j++) sum += out[j] * (j + 1);
+		if(i == 0) sum_ref = sum;
+
+		double ns = (t2 - t1) * 1.0E9 / ((double)rounds * cs.values);
+		printf("%-8s %6.2f ns/value %8.1f MB/s%s\n", list[i].name, ns,
+				cs.len * rounds / (t2 - t1) / 1.0E6,
+				sum == sum_ref ? "" : "  MISMATCH");
+	}
+
+	duc_free(out);
+	duc_free(cs.data);
+	duc_free(cs.count);
+	duc_free(cs.bytes);
+	duc_close(duc);
+
+	return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while((c = getopt(argc, argv, "t:")) != -1) {
+		switch(c) {
+			case 't':
+				opt_time = atof(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-t SECONDS] DATABASE\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-t SECONDS] DATABASE\n", argv[0]);
+		return 1;
+	}
+
+	duc *duc = duc_new();
+	int r = bench(duc, argv[optind]);
+	duc_del(duc);
+
+	return r;
+}
+
+/*
+ * End
+ */
+
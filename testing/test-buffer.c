@@ -0,0 +1,96 @@
+
+/*
+ * Checks of the directory record encoding, run by 'make check'
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "duc.h"
+#include "private.h"
+#include "buffer.h"
+
+#define COUNT 5
+
+static int failed = 0;
+
+#define CHECK(c) do { if(!(c)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); failed ++; } } while(0)
+
+
+static struct buffer *make_record(struct duc_dirent *ents)
+{
+	const struct duc_dirent *list[COUNT];
+	struct duc_devino parent = { 1, 2 };
+	int i;
+
+	for(i=0; i<COUNT; i++) {
+		ents[i].name = duc_malloc(8);
+		snprintf(ents[i].name, 8, "f%d", i);
+		ents[i].type = DUC_FILE_TYPE_REG;
+		ents[i].size.apparent = 1000 * (i + 1);
+		ents[i].size.actual = 512 * (COUNT - i);
+		ents[i].size.count = 1;
+		list[i] = &ents[i];
+	}
+
+	struct buffer *b = buffer_new(NULL, 0);
+	buffer_put_dir(b, &parent, 0, list, COUNT);
+	return b;
+}
+
+
+/*
+ * Decode the record, with the rank of the first entry set to that of the
+ * second when corrupt is set
+ */
+
+static void check_decode(int corrupt)
+{
+	struct duc_dirent ents[COUNT];
+	struct dir_header h;
+	uint64_t *rank;
+	int i;
+
+	struct buffer *b = make_record(ents);
+	struct buffer *r = buffer_new_view(b->data, b->len);
+
+	buffer_get_dir(r, &h, 0);
+	CHECK(h.count == COUNT);
+	CHECK(h.flags & DIR_FLAG_ACTUAL_BLOCKS);
+	CHECK(h.flags & DIR_FLAG_RANK_ACTUAL);
+	if(corrupt) b->data[r->ptr] = b->data[r->ptr + 1];
+
+	struct duc_dirent *list = buffer_get_dirents(r, &h, &rank);
+
+	CHECK((rank == NULL) == corrupt);
+	CHECK(h.flags & DIR_FLAG_ACTUAL_BLOCKS);
+	for(i=0; i<COUNT; i++) {
+		CHECK(strcmp(list[i].name, ents[i].name) == 0);
+		CHECK(list[i].size.apparent == ents[i].size.apparent);
+		CHECK(list[i].size.actual == ents[i].size.actual);
+		CHECK(list[i].size.count == ents[i].size.count);
+		duc_free(ents[i].name);
+	}
+
+	duc_free(rank);
+	duc_free(list);
+	buffer_free(r);
+	buffer_free(b);
+}
+
+
+int main(int argc, char **argv)
+{
+	check_decode(0);
+	check_decode(1);
+
+	return failed ? 1 : 0;
+}
+
+/*
+ * End
+ */